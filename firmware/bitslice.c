@@ -0,0 +1,560 @@
+/*
+ * Bit-sliced simulator of 64 MK-61 calculators.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include <string.h>
+
+#include "calc.h"
+#include "bitslice.h"
+
+#ifndef PLM_TRACE_CACHE
+#error Bit-sliced engine needs the trace cache
+#endif
+
+//
+// All lanes set, when bit n of x is set.
+//
+static inline slice_t bit_mask (unsigned x, unsigned n)
+{
+    return -(slice_t) ((x >> n) & 1);
+}
+
+//
+// Select lanes from a, when mask m is set, else from b.
+//
+static inline slice_t blend (slice_t m, slice_t a, slice_t b)
+{
+    return (a & m) | (b & ~m);
+}
+
+//
+// Lanes where a nibble is equal to a constant.
+//
+static inline slice_t equal (const slice_t x[4], unsigned value)
+{
+    return ~(x[0] ^ bit_mask (value, 0)) & ~(x[1] ^ bit_mask (value, 1)) &
+           ~(x[2] ^ bit_mask (value, 2)) & ~(x[3] ^ bit_mask (value, 3));
+}
+
+//
+// Get a nibble of one lane.
+//
+static inline unsigned get_nibble (const slice_t x[4], unsigned lane)
+{
+    return ((x[0] >> lane) & 1) | ((x[1] >> lane) & 1) << 1 |
+           ((x[2] >> lane) & 1) << 2 | ((x[3] >> lane) & 1) << 3;
+}
+
+//
+// Set a nibble of one lane.
+//
+static inline void set_nibble (slice_t x[4], unsigned lane, unsigned value)
+{
+    slice_t bit = 1ULL << lane;
+    int b;
+
+    for (b=0; b<4; b++)
+        x[b] = blend (bit, bit_mask (value, b), x[b]);
+}
+
+//
+// Check whether all lanes of a nibble are the same.
+//
+static inline int is_uniform (const slice_t x[4])
+{
+    int b;
+
+    for (b=0; b<4; b++)
+        if (x[b] != 0 && x[b] != ~0ULL)
+            return 0;
+    return 1;
+}
+
+//
+// Execute a micro-instruction on the lanes selected by mask sel,
+// with M register in the memory ring.
+// Keypad masks are computed by the caller:
+// kopq - op UCMD_KEYPAD loads Q from keyb_y;
+// pollq - keypad poll loads Q from keyb_y.
+//
+static inline __attribute__((always_inline))
+void bslice_exec (bslice_plm_t *t, slice_t M[][4], unsigned cycle,
+    const plm_ucmd_t *u, slice_t sel, slice_t kopq, slice_t pollq)
+{
+    unsigned op = u->op;
+    slice_t S[4], Q[4], r[4], x[4], sum[4];
+    slice_t carry = t->carry;
+    slice_t gamma, c;
+    int b;
+
+    for (b=0; b<4; b++) {
+        S[b] = t->S[b];
+        Q[b] = t->Q[b];
+        r[b] = t->R[cycle][b];
+    }
+    if (op & UCMD_OP(UCMD_KEYPAD)) {
+        for (b=0; b<4; b++)
+            Q[b] = blend (kopq, t->keyb_y[b], Q[b]);
+    }
+
+    /*
+     * Gamma is the carry input of the adder.
+     */
+    gamma = (carry & bit_mask (op, 0)) |
+            (~carry & bit_mask (op, 1)) |
+            (~t->keypad_event & bit_mask (op, 2));
+
+    /*
+     * Alpha and beta, added bit by bit.
+     */
+    c = gamma;
+    for (b=0; b<4; b++) {
+        slice_t alpha = (r[b] & bit_mask (u->alpha, b)) |
+                        (M[cycle][b] & bit_mask (u->alpha, 4 + b)) |
+                        (t->ST[cycle][b] & bit_mask (u->alpha, 8 + b)) |
+                        (~r[b] & bit_mask (u->alpha, 12 + b)) |
+                        (S[b] & bit_mask (u->alpha, 16 + b)) |
+                        bit_mask (u->alpha, 20 + b) |
+                        (~carry & bit_mask (u->alpha, 24 + b));
+        slice_t beta = (S[b] & bit_mask (u->beta, b)) |
+                       (~S[b] & bit_mask (u->beta, 4 + b)) |
+                       (Q[b] & bit_mask (u->beta, 8 + b)) |
+                       bit_mask (u->beta, 12 + b);
+        slice_t p = alpha ^ beta;
+
+        sum[b] = p ^ c;
+        c = (alpha & beta) | (c & p);
+    }
+    if (op & UCMD_OP(UCMD_CARRY_SUM))
+        carry = c;
+
+    // Keypad poll overrides Q after beta.
+    for (b=0; b<4; b++)
+        Q[b] = blend (pollq, t->keyb_y[b], Q[b]);
+
+    if (op & (UCMD_OP(UCMD_R_MASK) | UCMD_OP(UCMD_R1_SUM) | UCMD_OP(UCMD_R2_SUM))) {
+        slice_t rsel = (cycle >= 36) ? sel : sel & t->rmask;
+        unsigned cycle_plus_3 = cycle + 3;
+        unsigned cycle_minus_1 = cycle - 1 + REG_NWORDS;
+        unsigned cycle_minus_2 = cycle - 2 + REG_NWORDS;
+        if (cycle_plus_3 >= REG_NWORDS)
+            cycle_plus_3 -= REG_NWORDS;
+        if (cycle_minus_1 >= REG_NWORDS)
+            cycle_minus_1 -= REG_NWORDS;
+        if (cycle_minus_2 >= REG_NWORDS)
+            cycle_minus_2 -= REG_NWORDS;
+
+        for (b=0; b<4; b++) {
+            x[b] = r[b];
+            switch (op & UCMD_OP(UCMD_R_MASK)) {
+            case UCMD_OP(UCMD_R_R3):    x[b]  = t->R[cycle_plus_3][b]; break;
+            case UCMD_OP(UCMD_R_SUM):   x[b]  = sum[b];             break;
+            case UCMD_OP(UCMD_R_S):     x[b]  = S[b];               break;
+            case UCMD_OP(UCMD_R_RSSUM): x[b] |= S[b] | sum[b];      break;
+            case UCMD_OP(UCMD_R_SSUM):  x[b]  = S[b] | sum[b];      break;
+            case UCMD_OP(UCMD_R_RS):    x[b] |= S[b];               break;
+            case UCMD_OP(UCMD_R_RSUM):  x[b] |= sum[b];             break;
+            }
+            t->R[cycle][b] = blend (rsel, x[b], r[b]);
+            if (op & UCMD_OP(UCMD_R1_SUM))
+                t->R[cycle_minus_1][b] = blend (rsel, sum[b], t->R[cycle_minus_1][b]);
+            if (op & UCMD_OP(UCMD_R2_SUM))
+                t->R[cycle_minus_2][b] = blend (rsel, sum[b], t->R[cycle_minus_2][b]);
+        }
+    }
+
+    if (op & UCMD_OP(UCMD_M_S)) {
+        for (b=0; b<4; b++)
+            M[cycle][b] = blend (sel, S[b], M[cycle][b]);
+    }
+
+    for (b=0; b<4; b++) {
+        switch (op & UCMD_OP(UCMD_S_MASK)) {
+        case UCMD_OP(UCMD_S_Q):    S[b] = Q[b];            break;
+        case UCMD_OP(UCMD_S_SUM):  S[b] = sum[b];          break;
+        case UCMD_OP(UCMD_S_QSUM): S[b] = Q[b] | sum[b];   break;
+        }
+        if (op & UCMD_OP(UCMD_Q_SUM))
+            Q[b] = sum[b];
+    }
+
+    if (op & (UCMD_OP(UCMD_ST_SUM) | UCMD_OP(UCMD_ST_ROT))) {
+        unsigned cycle_plus_1 = cycle + 1;
+        unsigned cycle_plus_2 = cycle + 2;
+        if (cycle_plus_1 >= REG_NWORDS)
+            cycle_plus_1 = 0;
+        if (cycle_plus_2 >= REG_NWORDS)
+            cycle_plus_2 -= REG_NWORDS;
+
+        for (b=0; b<4; b++) {
+            slice_t st0 = t->ST[cycle][b];
+            slice_t st1 = t->ST[cycle_plus_1][b];
+            slice_t st2 = t->ST[cycle_plus_2][b];
+            slice_t n0 = st0, n1 = st1, n2 = st2, y;
+
+            if (op & UCMD_OP(UCMD_ST_SUM)) {
+                n2 = n1;
+                n1 = n0;
+                n0 = sum[b];
+            }
+            if (op & UCMD_OP(UCMD_ST_ROT)) {
+                y = n0;
+                n0 = n1;
+                n1 = n2;
+                n2 = y;
+            }
+            t->ST[cycle][b]        = blend (sel, n0, st0);
+            t->ST[cycle_plus_1][b] = blend (sel, n1, st1);
+            t->ST[cycle_plus_2][b] = blend (sel, n2, st2);
+        }
+    }
+    for (b=0; b<4; b++) {
+        t->S[b] = blend (sel, S[b], t->S[b]);
+        t->Q[b] = blend (sel, Q[b], t->Q[b]);
+    }
+    t->carry = blend (sel, carry, t->carry);
+}
+
+//
+// Lanes run different commands: find the micro-instruction address
+// of every lane, and execute every distinct micro-instruction
+// on its own lanes.
+//
+static __attribute__((noinline))
+void bslice_diverge (bslice_plm_t *t, slice_t M[][4], unsigned cycle,
+    slice_t kopq, slice_t pollq)
+{
+    slice_t mask [PLM_NUCMDS], seen [2] = { 0, 0 };
+    unsigned char list [BSLICE_NLANES];
+    unsigned lane, n = 0, i;
+
+    for (lane=0; lane<BSLICE_NLANES; lane++) {
+        unsigned inst_addr = t->trace[lane][cycle];
+        inst_addr = (inst_addr & ~TRACE_NCARRY) +
+                    ((inst_addr >> 7) & ~(t->carry >> lane) & 1);
+
+        if (! (seen[inst_addr >> 6] >> (inst_addr & 63) & 1)) {
+            seen[inst_addr >> 6] |= 1ULL << (inst_addr & 63);
+            mask[inst_addr] = 0;
+            list[n++] = inst_addr;
+        }
+        mask[inst_addr] |= 1ULL << lane;
+    }
+    for (i=0; i<n; i++)
+        bslice_exec (t, M, cycle, &t->rom->ucmd[list[i]], mask[list[i]],
+            kopq, pollq);
+}
+
+//
+// Fetch the command of every lane.
+//
+static void bslice_fetch (bslice_plm_t *t)
+{
+    unsigned lane, pc, command;
+    int uniform;
+
+    if (is_uniform (t->R[36]) && is_uniform (t->R[39])) {
+        // Same address on all lanes.
+        pc = get_nibble (t->R[36], 0) + (get_nibble (t->R[39], 0) << 4);
+        command = t->rom->cmd_rom[pc];
+        t->trace[0] = plm_trace (t->rom, pc);
+        for (lane=0; lane<BSLICE_NLANES; lane++) {
+            t->command[lane] = command;
+            t->trace[lane] = t->trace[0];
+        }
+        t->kmask = (command & 0xfc0000) ? ~0ULL : 0;
+        t->rmask = (command >> 24) ? 0 : ~0ULL;
+        t->uniform = 1;
+        return;
+    }
+
+    uniform = 1;
+    t->kmask = 0;
+    t->rmask = 0;
+    for (lane=0; lane<BSLICE_NLANES; lane++) {
+        pc = get_nibble (t->R[36], lane) + (get_nibble (t->R[39], lane) << 4);
+        command = t->rom->cmd_rom[pc];
+        t->command[lane] = command;
+        t->trace[lane] = plm_trace (t->rom, pc);
+        if (command & 0xfc0000)
+            t->kmask |= 1ULL << lane;
+        if (! (command >> 24))
+            t->rmask |= 1ULL << lane;
+        uniform &= (command == t->command[0]);
+    }
+    t->uniform = uniform;
+}
+
+//
+// Simulate one cycle of the PLM chip on all lanes,
+// except for the input/output.
+//
+static inline __attribute__((always_inline))
+void bslice_cycle (bslice_plm_t *t, slice_t M[][4], unsigned cycle)
+{
+    /* D stage in range 0...13 */
+    unsigned d = cycle / 3;
+    unsigned lane;
+    int b;
+
+    /*
+     * Fetch program counter from the R register.
+     */
+    if (cycle == 0) {
+        bslice_fetch (t);
+        t->keypad_event &= t->kmask;
+    }
+
+    /*
+     * Extended address of the command is loaded into R register.
+     */
+    if (cycle == 36) {
+        if (t->uniform) {
+            unsigned prog_index = (t->command[0] >> 16) & 0xff;
+            if (prog_index > 0x1f) {
+                for (b=0; b<4; b++) {
+                    t->R[37][b] = bit_mask (prog_index & 0xf, b);
+                    t->R[40][b] = bit_mask (prog_index >> 4, b);
+                }
+            }
+        } else for (lane=0; lane<BSLICE_NLANES; lane++) {
+            unsigned prog_index = (t->command[lane] >> 16) & 0xff;
+            if (prog_index > 0x1f) {
+                set_nibble (t->R[37], lane, prog_index & 0xf);
+                set_nibble (t->R[40], lane, prog_index >> 4);
+            }
+        }
+    }
+
+    /*
+     * Poll keypad.  It does not depend on the micro-instruction,
+     * so it is computed once for all lanes.
+     */
+    slice_t notk = ~t->kmask;
+    slice_t dmatch = equal (t->keyb_x, d + 1);
+    slice_t ypos = t->keyb_y[0] | t->keyb_y[1] | t->keyb_y[2] | t->keyb_y[3];
+    slice_t kopq = ~dmatch & ypos;
+    slice_t pollq = notk & dmatch & ypos;
+    slice_t carry = t->carry;
+
+    t->keypad_event &= ~(t->kmask & ~ypos);
+    t->keypad_event |= pollq;
+    t->enable_display |= notk;
+    if (d < 12) {
+        for (b=0; b<4; b++)
+            t->dot[b] = blend (notk & carry, bit_mask (d, b), t->dot[b]);
+    }
+    t->show_dot[d] = blend (notk, carry, t->show_dot[d]);
+
+    /*
+     * Execute the micro-instruction.  With the same command on all lanes,
+     * it can differ only by carry.
+     */
+    if (! t->uniform) {
+        bslice_diverge (t, M, cycle, kopq, pollq);
+
+    } else {
+        unsigned inst_addr = t->trace[0][cycle];
+
+        if (! (inst_addr & TRACE_NCARRY)) {
+            bslice_exec (t, M, cycle, &t->rom->ucmd[inst_addr], ~0ULL,
+                kopq, pollq);
+        } else {
+            inst_addr &= ~TRACE_NCARRY;
+            if (carry)
+                bslice_exec (t, M, cycle, &t->rom->ucmd[inst_addr], carry,
+                    kopq, pollq);
+            if (~carry)
+                bslice_exec (t, M, cycle, &t->rom->ucmd[inst_addr + 1],
+                    ~carry, kopq, pollq);
+        }
+    }
+}
+
+//
+// Simulate a word of the PLM chip on all lanes, with M register
+// in the memory ring, as plm_run_word().
+//
+static void bslice_run_word (bslice_plm_t *t, slice_t M[][4])
+{
+    unsigned i;
+
+    bslice_cycle (t, M, 0);
+    bslice_cycle (t, M, 1);
+    for (i=2; i<36; i++)
+        bslice_cycle (t, M, i);
+    bslice_cycle (t, M, 36);
+    bslice_cycle (t, M, 37);
+    bslice_cycle (t, M, 38);
+    bslice_cycle (t, M, 39);
+    bslice_cycle (t, M, 40);
+    bslice_cycle (t, M, 41);
+}
+
+//
+// Clear all lanes.
+//
+void bslice_init (bslice_t *s)
+{
+    memset (s, 0, sizeof(*s));
+}
+
+//
+// Simulate one step of all calculators.
+//
+slice_t bslice_step (bslice_t *s)
+{
+    unsigned k, lane;
+
+    for (lane=0; lane<BSLICE_NLANES; lane++) {
+        set_nibble (s->ik1302.keyb_x, lane, s->keycode[lane] >> 4);
+        set_nibble (s->ik1302.keyb_y, lane, s->keycode[lane] & 0xf);
+        set_nibble (s->ik1303.keyb_x, lane, s->rgd[lane]);
+        set_nibble (s->ik1303.keyb_y, lane, 1);
+    }
+
+    for (k=0; k<STEP_NWORDS; k++) {
+        bslice_run_word (&s->ik1302, RING_WORD (s, RING_IK1302));
+        bslice_run_word (&s->ik1303, RING_WORD (s, RING_IK1303));
+#ifndef MK_54
+        bslice_run_word (&s->ik1306, RING_WORD (s, RING_IK1306));
+#endif
+        // Move the head, as calc_shift_ring().
+        s->head++;
+        if (s->head >= RING_NWORDS)
+            s->head = 0;
+
+        // Display is cleared in manual mode, as by calc_step().
+        if (k % 14 < 12)
+            s->ik1302.enable_display &= equal (s->ik1302.dot, 11);
+    }
+    return equal (s->ik1302.dot, 11);
+}
+
+//
+// Copy PLM state between a calculator and a lane.
+//
+static void plm_load (bslice_plm_t *t, int lane, const plm_t *p)
+{
+    slice_t bit = 1ULL << lane;
+    unsigned i;
+
+    for (i=0; i<REG_NWORDS; i++) {
+        set_nibble (t->R[i], lane, p->R[i]);
+        set_nibble (t->ST[i], lane, p->ST[i]);
+    }
+    set_nibble (t->S, lane, p->S);
+    set_nibble (t->Q, lane, p->Q);
+    set_nibble (t->keyb_x, lane, p->keyb_x);
+    set_nibble (t->keyb_y, lane, p->keyb_y);
+    set_nibble (t->dot, lane, p->dot);
+    t->carry = blend (bit, bit_mask (p->carry, 0), t->carry);
+    t->keypad_event = blend (bit, bit_mask (p->keypad_event, 0), t->keypad_event);
+    t->enable_display = blend (bit, bit_mask (p->enable_display, 0), t->enable_display);
+    for (i=0; i<14; i++)
+        t->show_dot[i] = blend (bit, bit_mask (p->show_dot[i], 0), t->show_dot[i]);
+    t->command[lane] = p->command;
+    t->trace[lane] = p->trace;
+    t->kmask = blend (bit, (p->command & 0xfc0000) ? ~0ULL : 0, t->kmask);
+    t->rmask = blend (bit, (p->command >> 24) ? 0 : ~0ULL, t->rmask);
+    t->uniform = 0;
+    t->rom = p->rom;
+}
+
+static void plm_store (bslice_plm_t *t, int lane, plm_t *p)
+{
+    unsigned i;
+
+    for (i=0; i<REG_NWORDS; i++) {
+        p->R[i] = get_nibble (t->R[i], lane);
+        p->ST[i] = get_nibble (t->ST[i], lane);
+    }
+    p->S = get_nibble (t->S, lane);
+    p->Q = get_nibble (t->Q, lane);
+    p->keyb_x = get_nibble (t->keyb_x, lane);
+    p->keyb_y = get_nibble (t->keyb_y, lane);
+    p->dot = get_nibble (t->dot, lane);
+    p->carry = (t->carry >> lane) & 1;
+    p->keypad_event = (t->keypad_event >> lane) & 1;
+    p->enable_display = (t->enable_display >> lane) & 1;
+    for (i=0; i<14; i++)
+        p->show_dot[i] = (t->show_dot[i] >> lane) & 1;
+    p->command = t->command[lane];
+    p->trace = t->trace[lane];
+}
+
+//
+// Copy the state of a calculator to a lane.
+//
+int bslice_load (bslice_t *s, int lane, const calc_t *c)
+{
+    unsigned i;
+
+    if (lane < 0 || lane >= BSLICE_NLANES)
+        return 0;
+    if (! s->loaded) {
+        s->head = c->head;
+        s->loaded = 1;
+    } else if (c->head != s->head)
+        return 0;
+
+    plm_load (&s->ik1302, lane, &c->ik1302);
+    plm_load (&s->ik1303, lane, &c->ik1303);
+#ifndef MK_54
+    plm_load (&s->ik1306, lane, &c->ik1306);
+#endif
+    for (i=0; i<RING_NWORDS * REG_NWORDS; i++)
+        set_nibble (s->ring[i], lane, c->ring[i]);
+    s->keycode[lane] = c->ik1302.keyb_x << 4 | c->ik1302.keyb_y;
+    s->rgd[lane] = c->ik1303.keyb_x;
+    return 1;
+}
+
+//
+// Copy the state of a lane to a calculator.
+//
+void bslice_store (bslice_t *s, int lane, calc_t *c)
+{
+    unsigned i;
+
+    if (lane < 0 || lane >= BSLICE_NLANES)
+        return;
+    c->head = s->head;
+    plm_store (&s->ik1302, lane, &c->ik1302);
+    plm_store (&s->ik1303, lane, &c->ik1303);
+#ifndef MK_54
+    plm_store (&s->ik1306, lane, &c->ik1306);
+#endif
+    for (i=0; i<RING_NWORDS * REG_NWORDS; i++)
+        c->ring[i] = get_nibble (s->ring[i], lane);
+}
+
+//
+// Set the keypad state for a lane.
+//
+void bslice_set_keypad (bslice_t *s, int lane, int keycode, int rgd)
+{
+    if (lane < 0 || lane >= BSLICE_NLANES)
+        return;
+    s->keycode[lane] = keycode;
+    s->rgd[lane] = rgd;
+}
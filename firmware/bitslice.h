@@ -0,0 +1,94 @@
+/*
+ * Bit-sliced simulator of 64 MK-61 calculators.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+//
+// Experimental engine for exhaustive sweeps.  Every nibble is stored
+// as four 64-bit words: bit k of word b is bit b of the nibble
+// of calculator k.  The adder is computed as boolean logic.
+// Lanes with different commands are computed under masks,
+// so the engine is fast when most lanes run the same program path.
+//
+#define BSLICE_NLANES   64
+
+typedef unsigned long long slice_t;     // One bit of 64 calculators
+
+typedef struct {
+    slice_t R [REG_NWORDS] [4];         // R register
+    slice_t ST [REG_NWORDS] [4];        // ST register
+    slice_t S [4];
+    slice_t Q [4];
+    slice_t carry;
+    slice_t keypad_event;
+    slice_t keyb_x [4];
+    slice_t keyb_y [4];
+    slice_t dot [4];
+    slice_t enable_display;
+    slice_t show_dot [14];
+    slice_t kmask;                      // Command has keypad bits
+    slice_t rmask;                      // Command has no modifier
+    unsigned command [BSLICE_NLANES];
+    const unsigned char *trace [BSLICE_NLANES]; // Traces of current commands
+    int uniform;                        // All lanes run the same command
+    plm_rom_t *rom;
+} bslice_plm_t;
+
+typedef struct {
+    bslice_plm_t ik1302;
+    bslice_plm_t ik1303;
+#ifndef MK_54
+    bslice_plm_t ik1306;
+#endif
+    slice_t ring [RING_NWORDS * REG_NWORDS] [4]; // Memory ring, as in calc_t
+    unsigned head;                      // Head of the memory ring
+    int loaded;                         // Field head is set
+    unsigned char keycode [BSLICE_NLANES]; // Keys pressed
+    unsigned char rgd [BSLICE_NLANES];  // Radians/grads/degrees switch
+} bslice_t;
+
+//
+// Clear all lanes.
+//
+void bslice_init (bslice_t *s);
+
+//
+// Copy the state of a calculator to a lane.  All calculators
+// must have the same head of the memory ring.  Return 0 on mismatch.
+//
+int bslice_load (bslice_t *s, int lane, const calc_t *c);
+
+//
+// Copy the state of a lane to a calculator, initialized by calc_init().
+//
+void bslice_store (bslice_t *s, int lane, calc_t *c);
+
+//
+// Set the key pressed and the radians/grads/degrees switch for a lane.
+//
+void bslice_set_keypad (bslice_t *s, int lane, int keycode, int rgd);
+
+//
+// Simulate one step of all calculators, as calc_step().
+// Return a bit mask of lanes which run a user program.
+//
+slice_t bslice_step (bslice_t *s);
@@ -25,288 +25,1410 @@
 #include "calc.h"
 
 //
-// MK-54 calculator consists of two PLM chips ИК1301 and ИК1303,
-// and two serial FIFOs К145ИР2.
+// Initialize the calculator.
 //
-static plm_t ik1302, ik1303;
-static fifo_t fifo1, fifo2;
+void calc_init (calc_t *c, const calc_callbacks_t *callbacks, void *arg)
+{
+    int i;
+
+    #include "ik1302.c"
+    #include "ik1303.c"
+    static plm_rom_t ik1302_rom = {
+        ik1302_ucmd_rom, ik1302_cmd_rom, ik1302_prog_rom,
+    };
+    static plm_rom_t ik1303_rom = {
+        ik1303_ucmd_rom, ik1303_cmd_rom, ik1303_prog_rom,
+    };
+
+    plm_init (&c->ik1302, &ik1302_rom);
+    plm_init (&c->ik1303, &ik1303_rom);
 
 #ifndef MK_54
+    #include "ik1306.c"
+    static plm_rom_t ik1306_rom = {
+        ik1306_ucmd_rom, ik1306_cmd_rom, ik1306_prog_rom,
+    };
+
+    plm_init (&c->ik1306, &ik1306_rom);
+#endif
+    for (i=0; i<RING_NWORDS * REG_NWORDS; i++)
+        c->ring[i] = 0;
+    for (i=0; i<RING_NWORDS; i++)
+        c->ring_gen[i] = 0;
+    c->head = 0;
+    c->reference_mode = 0;
+    c->word = 0;
+    c->fetch_jump = 0;
+    c->nbreaks = 0;
+    c->break_pc = -1;
+    c->watches = 0;
+    c->nwatches = 0;
+    c->watch_hit = -1;
+    c->insn_pc = -1;
+    for (i=0; i<(CODE_NBYTES + 7) / 8; i++)
+        c->breaks[i] = 0;
+    c->headless = 0;
+    c->keycode = 0;
+    c->rgd = MODE_DEGREES;
+    c->input_gen = 0;
+    c->poll_quantum = 1;
+    c->poll_count = 0;
+    c->trace = 0;
+    for (i=0; i<12; i++) {
+        c->shown[i] = 15;
+        c->frame[i] = 0xff;
+    }
+    c->callbacks = callbacks;
+    c->arg = arg;
+#ifdef PLM_PROFILE
+    calc_profile_clear (c);
+#endif
+}
+
+//
+// Select per-cycle reference simulation, or word-level kernels.
 //
-// MK-61 has an additional chip ИК1306 in series.
+void calc_set_reference (calc_t *c, int on)
+{
+    c->reference_mode = on;
+}
+
+//
+// Select the headless mode.
+//
+void calc_set_headless (calc_t *c, int on)
+{
+    c->headless = on;
+}
+
 //
-static plm_t ik1306;
+// Push the input.
+//
+void calc_set_input (calc_t *c, int keycode, int rgd)
+{
+    if (c->keycode == keycode && c->rgd == rgd)
+        return;
+    c->keycode = keycode;
+    c->rgd = rgd;
+    c->input_gen++;
+}
+
+//
+// Set the number of words between calls of poll().
+//
+void calc_set_poll_quantum (calc_t *c, unsigned nwords)
+{
+    c->poll_quantum = nwords ? nwords : 1;
+    c->poll_count = 0;
+}
+
+//
+// Set the debug trace function.
+//
+void calc_set_trace (calc_t *c, void (*trace) (void *arg, unsigned word))
+{
+    c->trace = trace;
+}
+
+//
+// Move the head of the memory ring by one word,
+// as the serial shift of all chips does in 42 cycles.
+//
+static inline void calc_shift_ring (calc_t *c)
+{
+    c->head++;
+    if (c->head >= RING_NWORDS)
+        c->head = 0;
+}
+
+#ifdef PLM_PROFILE
+static void calc_profile_word (calc_t *c);
 #endif
 
 //
-// Initialize the calculator.
+// Count a change of the ring word at a given position.
+//
+#define RING_CHANGED(c, pos) \
+    (c)->ring_gen[((c)->head + (pos)) % RING_NWORDS]++
+
 //
-void calc_init()
+// Count a change of every word, written by calc_set_*() functions.
+//
+static void calc_ring_written (calc_t *c)
 {
-    #include "ik1302.c"
-    #include "ik1303.c"
+    int i;
 
-    plm_init (&ik1302, ik1302_ucmd_rom, ik1302_cmd_rom, ik1302_prog_rom);
-    plm_init (&ik1303, ik1303_ucmd_rom, ik1303_cmd_rom, ik1303_prog_rom);
+    for (i=0; i<RING_NWORDS; i++)
+        c->ring_gen[i]++;
+}
 
+//
+// Simulate one word of the calculator, chip by chip.
+// A chip receives data from its predecessor through M register,
+// with a delay of one word.  So the whole word of every chip can be
+// computed at once, with the same result as the per-cycle simulation.
+//
+static void calc_run_word (calc_t *c)
+{
+    if (plm_run_word (&c->ik1302, RING_WORD (c, RING_IK1302)))
+        RING_CHANGED (c, RING_IK1302);
+    if (plm_run_word (&c->ik1303, RING_WORD (c, RING_IK1303)))
+        RING_CHANGED (c, RING_IK1303);
 #ifndef MK_54
-    #include "ik1306.c"
-    plm_init (&ik1306, ik1306_ucmd_rom, ik1306_cmd_rom, ik1306_prog_rom);
+    if (plm_run_word (&c->ik1306, RING_WORD (c, RING_IK1306)))
+        RING_CHANGED (c, RING_IK1306);
+#endif
+    calc_shift_ring (c);
+#ifdef PLM_PROFILE
+    calc_profile_word (c);
 #endif
-    fifo_init (&fifo1);
-    fifo_init (&fifo2);
 }
 
 //
-// Simulate one cycle of the calculator.
-// Return 0 when stopped, or 1 when running a user program.
-// Fill digit[] and dit[] arrays with the indicator contents.
+// Simulate one word of the calculator, cycle by cycle.
+// This is the reference for calc_run_word().
+//
+static void calc_run_cycles (calc_t *c)
+{
+    unsigned char *m1302 = RING_WORD (c, RING_IK1302);
+    unsigned char *m1303 = RING_WORD (c, RING_IK1303);
+#ifndef MK_54
+    unsigned char *m1306 = RING_WORD (c, RING_IK1306);
+#endif
+    unsigned cycle, c1302 = 0, c1303 = 0;
+#ifndef MK_54
+    unsigned c1306 = 0;
+#endif
+
+    for (cycle=0; cycle<REG_NWORDS; cycle++) {
+        c1302 |= plm_step (&c->ik1302, m1302, cycle);
+        c1303 |= plm_step (&c->ik1303, m1303, cycle);
+#ifndef MK_54
+        c1306 |= plm_step (&c->ik1306, m1306, cycle);
+#endif
+    }
+    if (c1302)
+        RING_CHANGED (c, RING_IK1302);
+    if (c1303)
+        RING_CHANGED (c, RING_IK1303);
+#ifndef MK_54
+    if (c1306)
+        RING_CHANGED (c, RING_IK1306);
+#endif
+    calc_shift_ring (c);
+#ifdef PLM_PROFILE
+    calc_profile_word (c);
+#endif
+}
+
 //
-int calc_step()
+// Call poll() once per quantum of words.
+//
+static inline void calc_poll (calc_t *c)
 {
-    int k, i, digit, dot;
-    unsigned cycle;
+    const calc_callbacks_t *f = c->callbacks;
 
-    for (k=0; k<560; k++) {
-        // Scan keypad.
-        i = calc_keypad();
-        ik1302.keyb_x = i >> 4;
-        ik1302.keyb_y = i & 0xf;
-        ik1303.keyb_x = calc_rgd();
-        ik1303.keyb_y = 1;
+    if (f->poll && ++c->poll_count >= c->poll_quantum) {
+        c->poll_count = 0;
+        f->poll (c->arg);
+    }
+}
 
-        // Do computations.
-        for (cycle=0; cycle<REG_NWORDS; cycle++) {
-            calc_poll();
-            ik1302.input = fifo2.output;
-            plm_step (&ik1302, cycle);
-            ik1303.input = ik1302.output;
-            plm_step (&ik1303, cycle);
-#ifdef MK_54
-            fifo1.input = ik1303.output;
-#else
-            ik1306.input = ik1303.output;
-            plm_step (&ik1306, cycle);
-            fifo1.input = ik1306.output;
+//
+// Give the input, set by calc_set_input(), to the chips.
+//
+static inline void calc_load_input (calc_t *c)
+{
+    c->ik1302.keyb_x = c->keycode >> 4;
+    c->ik1302.keyb_y = c->keycode & 0xf;
+    c->ik1303.keyb_x = c->rgd;
+    c->ik1303.keyb_y = 1;
+}
+
+//
+// Poll the keypad and the switch by callbacks.
+// When one of them is zero, the pushed input is used instead.
+//
+static void calc_scan (calc_t *c)
+{
+    const calc_callbacks_t *f = c->callbacks;
+    int i;
+
+    i = f->keypad ? f->keypad (c->arg) : c->keycode;
+    c->ik1302.keyb_x = i >> 4;
+    c->ik1302.keyb_y = i & 0xf;
+    c->ik1303.keyb_x = f->rgd ? f->rgd (c->arg) : c->rgd;
+    c->ik1303.keyb_y = 1;
+}
+
+//
+// Show one symbol of the display, for a given word of calc_step().
+//
+static void calc_show (calc_t *c, unsigned k)
+{
+    const calc_callbacks_t *f = c->callbacks;
+    int i, digit, dot;
+
+    i = k % 14;
+    if (i >= 12) {
+        // Clear display.
+        if (f->display)
+            f->display (c->arg, -1, 0, 0);
+        return;
+    }
+    if (i < 3) {
+        // Exponent.
+        digit = c->ik1302.R [(i + 9) * 3];
+        dot = c->ik1302.show_dot [i + 10];
+    } else {
+        // Mantissa.
+        digit = c->ik1302.R [(i - 3) * 3];
+        dot = c->ik1302.show_dot [i - 2];
+    }
+
+    if (c->ik1302.dot == 11) {
+        // Run mode: blink once per step with dots enabled.
+        if (c->ik1302.command != 0x00117360)
+            digit = -1;
+        dot = 1;
+        c->shown[i] = (digit < 0 ? 15 : digit) | dot << 4;
+
+    } else if (c->ik1302.enable_display) {
+        // Manual mode.
+        c->ik1302.enable_display = 0;
+        c->shown[i] = digit | dot << 4;
+    } else {
+        // Clear display.
+        digit = -1;
+        dot = -1;
+    }
+    if (f->display)
+        f->display (c->arg, i, digit, dot);
+}
+
+//
+// Compare two blocks of bytes.  Firmware has no C library.
+//
+static int same_bytes (const void *a, const void *b, unsigned nbytes)
+{
+    const unsigned char *p = a, *q = b;
+
+    while (nbytes-- > 0)
+        if (*p++ != *q++)
+            return 0;
+    return 1;
+}
+
+//
+// Get the display, as calc_show() presents it: digit in low nibble,
+// dot in high nibble.  In run mode, all dots are on, and digits
+// are blank except for a blink once per step.
+//
+static void calc_frame (calc_t *c, unsigned char frame[12])
+{
+    int i, digit, dot;
+
+    for (i=0; i<12; i++) {
+        if (i < 3) {
+            // Exponent.
+            digit = c->ik1302.R [(i + 9) * 3];
+            dot = c->ik1302.show_dot [i + 10];
+        } else {
+            // Mantissa.
+            digit = c->ik1302.R [(i - 3) * 3];
+            dot = c->ik1302.show_dot [i - 2];
+        }
+        if (c->ik1302.dot == 11) {
+            if (c->ik1302.command != 0x00117360)
+                digit = 15;
+            dot = 1;
+        }
+        frame[i] = digit | dot << 4;
+    }
+}
+
+//
+// Decode the display on demand.
+//
+void calc_get_display (calc_t *c, unsigned char digit[12],
+    unsigned char dot[12])
+{
+    unsigned char frame [12];
+    int i;
+
+    calc_frame (c, frame);
+    for (i=0; i<12; i++) {
+        digit[i] = frame[i] & 15;
+        dot[i] = frame[i] >> 4;
+    }
+}
+
+//
+// Give the display to the user, as shown by calc_show(),
+// when changed since the last time.
+//
+static void calc_show_frame (calc_t *c)
+{
+    const calc_callbacks_t *f = c->callbacks;
+    unsigned char digit [12], dot [12];
+    int i;
+
+    if (! f->frame || same_bytes (c->shown, c->frame, sizeof (c->frame)))
+        return;
+    for (i=0; i<12; i++) {
+        c->frame[i] = c->shown[i];
+        digit[i] = c->shown[i] & 15;
+        dot[i] = c->shown[i] >> 4;
+    }
+    f->frame (c->arg, digit, dot);
+}
+
+//
+// Command of ИК1302 which polls the keypad.
+//
+#define KEYPAD_POLL(t)  (((t)->command & 0xfc0000) == 0)
+
+//
+// Command of ИК1302 in the idle loop, which waits for a key.
+//
+#define KEYPAD_IDLE     0x00005e5d
+
+//
+// The calculator is ready for a key: stopped in the idle loop,
+// and the previous key is released.
+//
+static int calc_ready (calc_t *c)
+{
+    return c->ik1302.dot != 11 && c->ik1302.command == KEYPAD_IDLE &&
+        ! c->ik1302.keypad_event;
+}
+
+//
+// At the fetch: tell whether a new user instruction is fetched.
+// Jumps fetch their address byte the same way, after the opcode.
+//
+static inline int calc_new_insn (calc_t *c)
+{
+    unsigned op;
+
+    if (c->fetch_jump) {
+        // Address byte of a jump.
+        c->fetch_jump = 0;
+        return 0;
+    }
+    op = c->ik1302.R[OPCODE_HIGH] << 4 | c->ik1302.R[OPCODE_LOW];
+    c->fetch_jump = INSN_FETCHES_TWICE (op);
+    return 1;
+}
+
+#ifdef PLM_PROFILE
+//
+// Count the word for the user instruction in progress.
+// The first instruction is fetched before the run mode is set,
+// and fetches are also made by keys in manual mode: an instruction
+// is finished when the program stops, or dropped when the calculator
+// gets back to the idle loop without running.  Address bytes of jumps
+// are fetched the same way as instructions, and belong to the jump.
+//
+static void calc_profile_word (calc_t *c)
+{
+    calc_profile_t *p = &c->profile;
+    unsigned op;
+
+    if (p->op < 0 && ! CALC_FETCH (c))
+        return;
+    p->nwords++;
+    if (c->ik1302.dot == 11)
+        p->running = 1;
+    if (CALC_FETCH (c)) {
+        if (p->fetch_jump) {
+            // Address byte of a jump.
+            p->fetch_jump = 0;
+            return;
+        }
+    } else if (c->ik1302.dot == 11 || ! calc_ready (c))
+        return;
+
+    // The instruction is finished: the next one is fetched,
+    // or the calculator waits for a key.
+    if (p->op >= 0 && p->running) {
+        p->words[p->op] += p->nwords;
+        p->count[p->op]++;
+    }
+    p->op = -1;
+    p->fetch_jump = 0;
+    if (! CALC_FETCH (c))
+        return;
+    op = c->ik1302.R[OPCODE_HIGH] << 4 | c->ik1302.R[OPCODE_LOW];
+    p->op = op;
+    p->nwords = 0;
+    p->fetch_jump = INSN_FETCHES_TWICE (op);
+    p->running = (c->ik1302.dot == 11);
+}
 #endif
-            fifo_step (&fifo1);
-            fifo2.input = fifo1.output;
-            fifo_step (&fifo2);
-            ik1302.M[cycle] = fifo2.output;
+
+//
+// Compare the value of a watchpoint in place, and remember it.
+// Return 1 when the watchpoint fires.
+//
+static int calc_watch_fired (calc_t *c, calc_watch_t *w)
+{
+    const unsigned char *data = c->ring + w->offset;
+    unsigned char value;
+    int i, changed = 0;
+
+    for (i=0; i<6; i++, data-=6) {
+        value = data[0] | data[-3] << 4;
+        if (value != w->value[i]) {
+            w->value[i] = value;
+            changed = 1;
+        }
+    }
+    if (! changed || c->insn_pc < 0)
+        return 0;
+    switch (w->cond) {
+    case CALC_WATCH_NEG:
+        if ((w->value[1] >> 4) != 9)
+            return 0;
+        break;
+    case CALC_WATCH_ZERO:
+        if (w->value[2] | w->value[3] | w->value[4] | w->value[5])
+            return 0;
+        break;
+    }
+    w->fired = 1;
+    w->pc = c->insn_pc;
+    return 1;
+}
+
+//
+// At the fetch of a new instruction in run mode: check watchpoints,
+// changed by the previous instruction, then breakpoints.
+// Return the reason to stop, or 0.
+//
+static int calc_debug_fetch (calc_t *c)
+{
+    unsigned pc = calc_get_pc (c);
+    int i, stop = 0;
+
+    for (i=0; i<c->nwatches; i++) {
+        if (calc_watch_fired (c, &c->watches[i]) && ! stop) {
+            c->watch_hit = i;
+            stop = CALC_WATCH;
         }
-#if 0
-        // Debug trace.
-        if (ik1302.dot == 11 && k%14 == 0) {
-            printf ("             %-2u :", k/14);
-            for (i=0; i<12; i++) {
-                if (11-i < 3) {
-                    // Exponent.
-                    digit = ik1302.R [(11-i + 9) * 3];
-                    dot = ik1302.show_dot [11-i + 10];
-                } else {
-                    // Mantissa.
-                    digit = ik1302.R [(11-i - 3) * 3];
-                    dot = ik1302.show_dot [11-i - 2];
-                }
-                putchar ("0123456789-LCRE " [digit]);
-                if (dot)
-                    putchar ('.');
+    }
+    c->insn_pc = pc;
+    if (pc < CODE_NBYTES && (c->breaks[pc >> 3] >> (pc & 7) & 1)) {
+        c->break_pc = pc;
+        if (! stop)
+            stop = CALC_BREAK;
+    }
+    return stop;
+}
+
+#ifdef CALC_IDLE_SKIP
+//
+// Detection of the idle loop.  The calculator is idle, when it is
+// stopped in the loop which polls the keypad, and with the same input
+// the state repeats after RING_NWORDS words: the head of the ring makes
+// a full turn.  The state of ИК1302, and so the display, must be
+// the same after every word of the turn.  Then any number of words
+// can be skipped: only the remainder of a turn is simulated.
+// States are compared after simulation of a word, before calc_show()
+// clears enable_display: the microcode never reads it.
+//
+typedef struct {
+    calc_state_t base;                  // State at the start of the turn
+    calc_state_t now;                   // State after the last word
+    unsigned input;                     // Keys and switch of the turn
+    unsigned nwords;                    // Words since the start
+    int valid;                          // The turn is started
+    int found;                          // The idle loop is found
+    unsigned long skipped;              // Words skipped
+} idle_t;
+
+//
+// Get the position of the keys and the switch, as seen by the chips.
+//
+static inline unsigned calc_input (calc_t *c)
+{
+    return c->ik1302.keyb_x << 12 | c->ik1302.keyb_y << 8 |
+           c->ik1303.keyb_x << 4 | c->ik1303.keyb_y;
+}
+
+//
+// Check the state after a simulated word.
+//
+static void idle_check (calc_t *c, idle_t *d)
+{
+    if (c->ik1302.dot == 11 || c->ik1302.command != KEYPAD_IDLE) {
+        d->valid = 0;
+        return;
+    }
+    if (d->valid && d->input == calc_input (c)) {
+        calc_save_state (c, &d->now);
+        d->now.word[0] = d->base.word[0];
+        d->now.word[1] = d->base.word[1];
+        if (same_bytes (&d->now.ik1302, &d->base.ik1302, sizeof (plm_state_t))) {
+            if (++d->nwords < RING_NWORDS)
+                return;
+            if (same_bytes (&d->now, &d->base, sizeof (calc_state_t))) {
+                d->found = 1;
+                d->skipped = 0;
+                return;
             }
-            printf ("' (%x %x) %08x\n", ik1302.R[39], ik1302.R[36], ik1302.command);
         }
+    }
+
+    // Start a new turn from here.
+    calc_save_state (c, &d->base);
+    d->input = calc_input (c);
+    d->nwords = 0;
+    d->valid = 1;
+}
+
+//
+// Leave the idle loop: simulate the remainder of the last turn
+// with the input of the loop.  Enable_display is kept as left
+// by calc_show().
+//
+static void idle_resume (calc_t *c, idle_t *d)
+{
+    unsigned x = c->ik1302.keyb_x, y = c->ik1302.keyb_y;
+    unsigned rgd = c->ik1303.keyb_x, e = c->ik1302.enable_display;
+    unsigned n = d->skipped % RING_NWORDS;
+
+    c->ik1302.keyb_x = d->base.ik1302.keyb_x;
+    c->ik1302.keyb_y = d->base.ik1302.keyb_y;
+    c->ik1303.keyb_x = d->base.ik1303.keyb_x;
+    while (n-- > 0)
+        calc_run_word (c);
+    c->ik1302.keyb_x = x;
+    c->ik1302.keyb_y = y;
+    c->ik1303.keyb_x = rgd;
+    c->ik1302.enable_display = e;
+    d->valid = 0;
+    d->found = 0;
+}
 #endif
 
-        i = k % 14;
-        if (i >= 12) {
-            // Clear display.
-            calc_display (-1, 0, 0);
+//
+// Simulate one step with breakpoints or watchpoints, word by word.
+// Every fetch of a user instruction is checked, and the idle loop
+// is not skipped.
+//
+static int calc_step_break (calc_t *c)
+{
+    unsigned k;
+
+    // Jumps are not followed by the fast simulation.
+    if (calc_ready (c))
+        c->fetch_jump = 0;
+    for (k=0; k<STEP_NWORDS; k++) {
+        if (c->headless)
+            calc_load_input (c);
+        else
+            calc_scan (c);
+        calc_step_word (c);
+        if (! c->headless)
+            calc_show (c, k);
+
+        if (c->ik1302.dot == 11) {
+            if (CALC_FETCH (c) && calc_new_insn (c) && calc_debug_fetch (c))
+                break;
         } else {
-            if (i < 3) {
-                // Exponent.
-                digit = ik1302.R [(i + 9) * 3];
-                dot = ik1302.show_dot [i + 10];
-            } else {
-                // Mantissa.
-                digit = ik1302.R [(i - 3) * 3];
-                dot = ik1302.show_dot [i - 2];
-            }
+            // The first instruction is fetched before the run mode
+            // is set, and keys in manual mode fetch instructions too.
+            c->insn_pc = -1;
+            if (calc_ready (c))
+                c->fetch_jump = 0;
+            else if (CALC_FETCH (c))
+                calc_new_insn (c);
+        }
+    }
+    if (! c->headless)
+        calc_show_frame (c);
+    return (c->ik1302.dot == 11);
+}
 
-            if (ik1302.dot == 11) {
-                // Run mode: blink once per step with dots enabled.
-                if (ik1302.command != 0x00117360)
-                    digit = -1;
-                calc_display (i, digit, 1);
+//
+// Simulate one step of the calculator: STEP_NWORDS words,
+// less when a breakpoint or a watchpoint stops it.
+// Return 0 when stopped, or 1 when running a user program.
+// Show the display symbol by symbol, and the frame at the end.
+//
+int calc_step (calc_t *c)
+{
+    const calc_callbacks_t *f = c->callbacks;
+    unsigned gen = c->input_gen;
+    int k;
+#ifdef CALC_IDLE_SKIP
+    idle_t idle;
 
-            } else if (ik1302.enable_display) {
-                // Manual mode.
-                calc_display (i, digit, dot);
-                ik1302.enable_display = 0;
-            } else {
-                // Clear display.
-                calc_display (i, -1, -1);
+    idle.valid = 0;
+    idle.found = 0;
+#endif
+    c->break_pc = -1;
+    c->watch_hit = -1;
+    if (c->nbreaks || c->nwatches)
+        return calc_step_break (c);
+    if (c->headless) {
+        // Pure simulation of the chips: input is set in advance,
+        // display is decoded on demand.
+        calc_load_input (c);
+        calc_fast_forward (c, STEP_NWORDS);
+        return (c->ik1302.dot == 11);
+    }
+    if (! f->keypad && ! f->rgd)
+        calc_load_input (c);
+    for (k=0; k<STEP_NWORDS; k++) {
+        // Scan keypad.
+        if (f->keypad || f->rgd)
+            calc_scan (c);
+        else if (gen != c->input_gen) {
+            // Input is pushed.
+            gen = c->input_gen;
+            calc_load_input (c);
+        }
+        calc_poll (c);
+#ifdef CALC_IDLE_SKIP
+        if (idle.found) {
+            if (calc_input (c) == idle.input) {
+                // Idle: skip the word, and show the same display.
+                idle.skipped++;
+                c->ik1302.enable_display = idle.base.ik1302.enable_display;
+                calc_show (c, k);
+                continue;
             }
+            idle_resume (c, &idle);
         }
+#endif
+        // Do computations.
+        if (! c->reference_mode) {
+            calc_run_word (c);
+#ifdef CALC_IDLE_SKIP
+            idle_check (c, &idle);
+#endif
+        } else
+            calc_run_cycles (c);
+        if (c->trace)
+            c->trace (c->arg, (c->word + k) % STEP_NWORDS);
+
+        calc_show (c, k);
     }
-    return (ik1302.dot == 11);
+#ifdef CALC_IDLE_SKIP
+    if (idle.found)
+        idle_resume (c, &idle);
+#endif
+    calc_show_frame (c);
+    return (c->ik1302.dot == 11);
 }
 
-typedef struct {
-    unsigned char chip;
-    unsigned char address;
-} location_t;
-
-static const location_t memory_map[15] = {
-    {1, 41}, {1, 83}, {1, 125}, {1, 167}, {1, 209}, {1, 251},
-    {2, 41}, {2, 83}, {2, 125}, {2, 167}, {2, 209}, {2, 251},
-    {3, 41}, {4, 41}, {5, 41},
-};
-
-static const location_t stack_map[15] = {
-    {1, 34}, {1, 76}, {1, 118}, {1, 160}, {1, 202}, {1, 244},
-    {2, 34}, {2, 76}, {2, 118}, {2, 160}, {2, 202}, {2, 244},
-    {3, 34}, {4, 34}, {5, 34},
-};
-
-#ifdef MK_54
-//
-// For MK-54.
-//
-static const unsigned char remap_memory[3][DATA_NREGS] = {
-    { 1, 2, 3, 4, 5, 13, 12, 6,  7,  8,  9,  10, 11, 0 },
-    { 3, 4, 5, 0, 1, 13, 12, 8,  9,  10, 11, 6,  7,  2 },
-    { 5, 0, 1, 2, 3, 13, 12, 10, 11, 6,  7,  8,  9,  4 },
-};
-
-static const unsigned char remap_stack[3][5] = {
-    { 8,  9,  10, 11, 0 },
-    { 10, 11, 6,  7,  2 },
-    { 6,  7,  8,  9,  4 },
-};
-#else
-//
-// For MK-61
-//
-static const unsigned char remap_memory[3][DATA_NREGS] = {
-    { 1,  2,  3,  4,  5,  14, 13, 12, 6, 7, 8,  9,  10, 11, 0 },
-    { 10, 11, 6,  7,  2,  3,  4,  5,  0, 1, 14, 13, 12, 8,  9 },
-    { 14, 13, 12, 10, 11, 6,  7,  8,  9, 4, 5,  0,  1,  2,  3 },
-};
-
-static const unsigned char remap_stack[3][5] = {
-    { 8,  9,  10, 11, 0 },
-    { 14, 13, 12, 8,  9 },
-    { 5,  0,  1,  2,  3 },
-};
-#endif
+//
+// Simulate one word of the calculator, without polling
+// the keypad and updating the display.
+//
+int calc_step_word (calc_t *c)
+{
+    if (! c->headless)
+        calc_poll (c);
+    if (! c->reference_mode)
+        calc_run_word (c);
+    else
+        calc_run_cycles (c);
+    if (c->trace)
+        c->trace (c->arg, c->word);
+
+    c->word++;
+    if (c->word >= STEP_NWORDS)
+        c->word = 0;
+    return (c->ik1302.dot == 11);
+}
 
 //
-// Get the base address of chip memory.
+// Advance the calculator by a given number of words.
 //
-static unsigned char *chip_base (unsigned chip)
+unsigned long calc_fast_forward (calc_t *c, unsigned long nwords)
 {
-    switch (chip) {
-    case 1: return fifo1.data;
-    case 2: return fifo2.data;
-    case 3: return ik1302.M;
-    case 4: return ik1303.M;
-#ifndef MK_54
-    case 5: return ik1306.M;
+    unsigned long n;
+    unsigned word = c->word;
+#ifdef CALC_IDLE_SKIP
+    idle_t idle;
+
+    idle.valid = 0;
+    idle.found = 0;
 #endif
+    c->word = (word + nwords) % STEP_NWORDS;
+    for (n=0; n<nwords; n++) {
+#ifdef CALC_IDLE_SKIP
+        if (idle.found) {
+            // Idle: skip the rest.
+            idle.skipped = nwords - n;
+            idle_resume (c, &idle);
+            return n + idle.skipped % RING_NWORDS;
+        }
+#endif
+        if (! c->reference_mode) {
+            calc_run_word (c);
+#ifdef CALC_IDLE_SKIP
+            idle_check (c, &idle);
+#endif
+        } else
+            calc_run_cycles (c);
+        if (c->trace)
+            c->trace (c->arg, (word + n) % STEP_NWORDS);
     }
-    return 0;
+    return nwords;
 }
 
 //
-// Extract stack and register values from the serial shift registers.
+// Simulate one word with a given key pressed.  With show flag,
+// poll the switch and show one symbol of the display,
+// as calc_step() does.
 //
-static void fetch_value (unsigned char result[], unsigned chip, unsigned address)
+static void calc_key_word (calc_t *c, int keycode, int show)
+{
+    const calc_callbacks_t *f = c->callbacks;
+    unsigned k;
+
+    c->ik1302.keyb_x = keycode >> 4;
+    c->ik1302.keyb_y = keycode & 0xf;
+    if (! show) {
+        calc_step_word (c);
+        return;
+    }
+    c->ik1303.keyb_x = (c->headless || ! f->rgd) ? c->rgd : f->rgd (c->arg);
+    c->ik1303.keyb_y = 1;
+    k = c->word;
+    calc_step_word (c);
+    if (! c->headless)
+        calc_show (c, k);
+}
+
+//
+// Wait until the calculator is ready, press a key and release it
+// as soon as ИК1302 has taken it: the key is latched, and
+// the microcode left the polling command.
+// Return the number of words, or 0 when more than a limit is needed.
+//
+static unsigned long calc_take_key (calc_t *c, int keycode,
+    unsigned long limit, int show)
+{
+    unsigned long n = 0;
+
+    while (! calc_ready (c)) {
+        if (n++ >= limit)
+            return 0;
+        calc_key_word (c, 0, show);
+    }
+    while (! c->ik1302.keypad_event) {
+        if (n++ >= limit)
+            return 0;
+        calc_key_word (c, keycode, show);
+    }
+    while (KEYPAD_POLL (&c->ik1302)) {
+        if (n++ >= limit)
+            return 0;
+        calc_key_word (c, keycode, show);
+    }
+    c->ik1302.keyb_x = 0;
+    c->ik1302.keyb_y = 0;
+    return n;
+}
+
+//
+// Press a key, then simulate until the calculator is ready
+// for the next key.
+//
+unsigned long calc_press_key (calc_t *c, int keycode, unsigned long limit)
+{
+    unsigned long n;
+
+    n = calc_take_key (c, keycode, limit, 1);
+    if (n == 0)
+        return 0;
+    while (! calc_ready (c)) {
+        if (n++ >= limit)
+            return 0;
+        calc_key_word (c, 0, 1);
+    }
+    if (! c->headless)
+        calc_show_frame (c);
+    return n;
+}
+
+//
+// Simulate until the program stops, or a limit is reached.
+//
+int calc_run (calc_t *c, calc_run_t *r)
+{
+    unsigned char frame [12], last [12];
+    unsigned long nstable = 0;
+    unsigned i;
+    int stop;
+
+    c->break_pc = -1;
+    c->watch_hit = -1;
+    r->words = 0;
+    r->insns = 0;
+    if (calc_ready (c))
+        c->fetch_jump = 0;
+    if (r->keycode) {
+        r->words = calc_take_key (c, r->keycode, r->max_words, 0);
+        if (r->words == 0) {
+            r->words = r->max_words;
+            return CALC_BUDGET;
+        }
+    }
+    calc_frame (c, last);
+    for (;;) {
+        if (r->words >= r->max_words)
+            return CALC_BUDGET;
+        calc_step_word (c);
+        r->words++;
+
+        if (calc_ready (c)) {
+            c->fetch_jump = 0;
+            return CALC_STOPPED;
+        }
+
+        if (c->ik1302.dot != 11)
+            c->insn_pc = -1;
+        if (CALC_FETCH (c)) {
+            if (calc_new_insn (c)) {
+                r->insns++;
+                if ((c->nbreaks || c->nwatches) && c->ik1302.dot == 11 &&
+                    (stop = calc_debug_fetch (c)) != 0)
+                    return stop;
+            }
+            if (r->max_insns && r->insns >= r->max_insns)
+                return CALC_INSNS;
+        }
+
+        if (r->stable_words) {
+            calc_frame (c, frame);
+            if (same_bytes (frame, last, sizeof (frame))) {
+                if (++nstable >= r->stable_words)
+                    return CALC_STABLE;
+            } else {
+                nstable = 0;
+                for (i=0; i<sizeof (frame); i++)
+                    last[i] = frame[i];
+            }
+        }
+    }
+}
+
+//
+// The head of the ring moves by one word every simulated word,
+// so data stay at the same place in the buffer: a word of memory
+// register i also holds instructions 7*i...7*i+6.
+//
+#define REG_WORD(c, i)      ((c)->ring + ((i) + 8) % RING_NWORDS * REG_NWORDS)
+#define STACK_WORD(c, i)    ((c)->ring + ((i) + 3) * REG_NWORDS)
+
+#define REG_ADDRESS         33          // Value of memory register
+#define STACK_ADDRESS       34          // Value of stack register
+#define CODE_ADDRESS(i)     ((i) ? (i)*6 - 1 : 41) // Instruction in a word
+
+//
+// Extract a value from the serial shift registers.
+// Nibbles are stored in every third cycle, from high address down.
+//
+static void fetch_value (unsigned char result[], const unsigned char *data)
 {
-    unsigned char *data = chip_base(chip);
     int i;
 
-    if (data) {
-        data += address;
-        for (i=0; i<6; i++, data-=6)
-            result[i] = data[0] | data[-3] << 4;
-    } else {
-        for (i=0; i<6; i++)
-            result[i] = 0;
+    for (i=0; i<6; i++, data-=6)
+        result[i] = data[0] | data[-3] << 4;
+}
+
+//
+// Store a value to the serial shift registers.
+//
+static void store_value (const unsigned char value[], unsigned char *data)
+{
+    int i;
+
+    for (i=0; i<6; i++, data-=6) {
+        data[0] = value[i] & 0x0f;
+        data[-3] = value[i] >> 4;
     }
 }
 
 //
 // Extract stack values from the serial shift registers.
 //
-void calc_get_stack (unsigned char stack[5][6])
+void calc_get_stack (calc_t *c, unsigned char stack[5][6])
 {
-    int phase = fifo1.cycle / (2*REG_NWORDS);
     int i;
 
-    for (i=0; i<5; i++) {
-        location_t loc = stack_map[remap_stack[phase][i]];
-        fetch_value (stack[i], loc.chip, loc.address);
-    }
+    for (i=0; i<5; i++)
+        fetch_value (stack[i], STACK_WORD (c, i) + STACK_ADDRESS);
+}
+
+//
+// Write stack values to the serial shift registers.
+//
+void calc_set_stack (calc_t *c, unsigned char stack[5][6])
+{
+    int i;
+
+    for (i=0; i<5; i++)
+        store_value (stack[i], STACK_WORD (c, i) + STACK_ADDRESS);
+    calc_ring_written (c);
 }
 
 //
 // Extract memory register values from the serial shift registers.
 //
-void calc_get_regs (unsigned char reg[][6])
+void calc_get_regs (calc_t *c, unsigned char reg[][6])
 {
-    int phase = fifo1.cycle / (2*REG_NWORDS);
     int i;
 
-    for (i=0; i<DATA_NREGS; i++) {
-        location_t loc = memory_map[remap_memory[phase][i]];
-        fetch_value (reg[i], loc.chip, loc.address - 8);
-    }
+    for (i=0; i<DATA_NREGS; i++)
+        fetch_value (reg[i], REG_WORD (c, i) + REG_ADDRESS);
+}
+
+//
+// Write memory register values to the serial shift registers.
+//
+void calc_set_regs (calc_t *c, unsigned char reg[][6])
+{
+    int i;
+
+    for (i=0; i<DATA_NREGS; i++)
+        store_value (reg[i], REG_WORD (c, i) + REG_ADDRESS);
+    calc_ring_written (c);
 }
 
 //
 // Extract program code from the serial shift registers.
 //
-void calc_get_code (unsigned char code[])
+void calc_get_code (calc_t *c, unsigned char code[])
 {
     int i;
-    int phase = fifo1.cycle / (2*REG_NWORDS);
-    const unsigned char *remap = remap_memory[phase];
 
     for (i=0; i<CODE_NBYTES; i++) {
         // Compute the location of the instruction in chip memory.
-        location_t loc = memory_map[remap[i / 7]];
-        int rem = i % 7;
-        if (rem != 0)
-            loc.address += rem*6 - 42;
-
-        // Fetch the opcode.
-        unsigned char *data = chip_base(loc.chip);
-        if (! data)                     // Cannot happen
-            continue;
-        code[i] = data[loc.address] << 4 | data[loc.address - 3];
+        unsigned char *data = REG_WORD (c, i / 7) +
+            CODE_ADDRESS (i % 7);
+
+        code[i] = data[0] << 4 | data[-3];
     }
 }
 
 //
 // Write program code to the serial shift registers.
 //
-void calc_write_code (unsigned char code[])
+void calc_write_code (calc_t *c, unsigned char code[])
 {
     int i;
-    int phase = fifo1.cycle / (2*REG_NWORDS);
-    const unsigned char *remap = remap_memory[phase];
 
     for (i=0; i<CODE_NBYTES; i++) {
         // Compute the location of the instruction in chip memory.
-        location_t loc = memory_map[remap[i / 7]];
-        int rem = i % 7;
-        if (rem != 0)
-            loc.address += rem*6 - 42;
-
-        // Fetch the opcode.
-        unsigned char *data = chip_base(loc.chip);
-        if (! data)                     // Cannot happen
+        unsigned char *data = REG_WORD (c, i / 7) +
+            CODE_ADDRESS (i % 7);
+
+        data[0] = code[i] >> 4;
+        data[-3] = code[i] & 0x0f;
+    }
+    calc_ring_written (c);
+}
+
+//
+// Get an address from two digits in R register of ИК1302.
+//
+static inline unsigned get_address (calc_t *c, int tens, int units)
+{
+    return c->ik1302.R[tens] * 10 + c->ik1302.R[units];
+}
+
+//
+// Get the program counter.
+//
+unsigned calc_get_pc (calc_t *c)
+{
+    return get_address (c, PC_TENS, PC_UNITS);
+}
+
+//
+// Get the return stack.
+//
+void calc_get_rstack (calc_t *c, unsigned rstack[CALC_NRETURN])
+{
+    int i;
+
+    for (i=0; i<CALC_NRETURN; i++)
+        rstack[i] = get_address (c, RSTACK_TENS(i), RSTACK_UNITS(i));
+}
+
+//
+// Set or clear a breakpoint.
+//
+void calc_set_break (calc_t *c, unsigned addr, int on)
+{
+    unsigned char bit = 1 << (addr & 7);
+
+    if (addr >= CODE_NBYTES || ! (c->breaks[addr >> 3] & bit) == ! on)
+        return;
+    c->breaks[addr >> 3] ^= bit;
+    c->nbreaks += on ? 1 : -1;
+}
+
+//
+// Get the breakpoint reached.
+//
+int calc_get_break (calc_t *c)
+{
+    return c->break_pc;
+}
+
+//
+// Set watchpoints, with current values.
+//
+int calc_set_watches (calc_t *c, calc_watch_t *w, int n)
+{
+    int i;
+
+    c->watches = 0;
+    c->nwatches = 0;
+    c->watch_hit = -1;
+    for (i=0; i<n; i++) {
+        if ((unsigned) w[i].reg >= DATA_NREGS &&
+            (w[i].reg < CALC_WATCH_X1 || w[i].reg > CALC_WATCH_T))
+            return 0;
+        if ((unsigned) w[i].cond > CALC_WATCH_ZERO)
+            return 0;
+    }
+    for (i=0; i<n; i++) {
+        if (w[i].reg >= CALC_WATCH_X1)
+            w[i].offset = STACK_WORD (c, w[i].reg - CALC_WATCH_X1) +
+                STACK_ADDRESS - c->ring;
+        else
+            w[i].offset = REG_WORD (c, w[i].reg) + REG_ADDRESS - c->ring;
+        fetch_value (w[i].value, c->ring + w[i].offset);
+        w[i].fired = 0;
+        w[i].pc = 0;
+    }
+    c->watches = w;
+    c->nwatches = n;
+    return 1;
+}
+
+//
+// Get the watchpoint fired.
+//
+int calc_get_watch (calc_t *c)
+{
+    return c->watch_hit;
+}
+
+#ifdef PLM_PROFILE
+//
+// Clear the counters of the profile.
+//
+void calc_profile_clear (calc_t *c)
+{
+    calc_profile_t *p = &c->profile;
+    plm_t *chip[3];
+    int nchips = 0, i, k;
+
+    chip[nchips++] = &c->ik1302;
+    chip[nchips++] = &c->ik1303;
+#ifndef MK_54
+    chip[nchips++] = &c->ik1306;
+#endif
+    for (k=0; k<nchips; k++) {
+        for (i=0; i<PLM_NCMDS; i++)
+            chip[k]->cmd_count[i] = 0;
+        for (i=0; i<PLM_NUCMDS; i++)
+            chip[k]->ucmd_count[i] = 0;
+    }
+    for (i=0; i<256; i++) {
+        p->words[i] = 0;
+        p->count[i] = 0;
+    }
+    p->op = -1;
+    p->fetch_jump = 0;
+    p->nwords = 0;
+    p->running = 0;
+}
+#endif
+
+//
+// Compute locations of values for the view.
+//
+void calc_view_init (calc_view_t *v, const calc_t *c)
+{
+    int i;
+
+    v->calc = c;
+    for (i=0; i<DATA_NREGS; i++)
+        v->reg[i] = REG_WORD (c, i) - c->ring;
+    for (i=0; i<5; i++)
+        v->stack[i] = STACK_WORD (c, i) - c->ring;
+    v->dirty = CALC_VIEW_STACK | CALC_VIEW_REGS | CALC_VIEW_CODE;
+
+    // Compare all values on the first call.
+    for (i=0; i<RING_NWORDS; i++)
+        v->seen_gen[i] = c->ring_gen[i] - 1;
+}
+
+//
+// Read one stack value.
+//
+void calc_view_stack (const calc_view_t *v, int i, unsigned char value[6])
+{
+    fetch_value (value, v->calc->ring + v->stack[i] + STACK_ADDRESS);
+}
+
+//
+// Read one memory register.
+//
+void calc_view_reg (const calc_view_t *v, int i, unsigned char value[6])
+{
+    fetch_value (value, v->calc->ring + v->reg[i] + REG_ADDRESS);
+}
+
+//
+// Read one instruction: seven of them are kept in a register word.
+//
+unsigned calc_view_code (const calc_view_t *v, int addr)
+{
+    const unsigned char *data = v->calc->ring + v->reg[addr / 7] +
+        CODE_ADDRESS (addr % 7);
+
+    return data[0] << 4 | data[-3];
+}
+
+//
+// Compare values with the ones seen last time,
+// only in words of the ring which have changed since then.
+//
+unsigned calc_view_changed (calc_view_t *v)
+{
+    const calc_t *c = v->calc;
+    unsigned char value [6];
+    unsigned mask, op, words = 0;
+    int i, k;
+
+    for (i=0; i<RING_NWORDS; i++) {
+        if (c->ring_gen[i] != v->seen_gen[i]) {
+            v->seen_gen[i] = c->ring_gen[i];
+            words |= 1 << i;
+        }
+    }
+    for (i=0; i<5; i++) {
+        if (! (words >> (v->stack[i] / REG_NWORDS) & 1))
             continue;
-        data[loc.address] = code[i] >> 4;
-        data[loc.address - 3] = code[i] & 0x0f;
+        calc_view_stack (v, i, value);
+        for (k=0; k<6; k++) {
+            if (value[k] != v->seen_stack[i][k]) {
+                v->seen_stack[i][k] = value[k];
+                v->dirty |= CALC_VIEW_STACK;
+            }
+        }
+    }
+    for (i=0; i<DATA_NREGS; i++) {
+        if (! (words >> (v->reg[i] / REG_NWORDS) & 1))
+            continue;
+        calc_view_reg (v, i, value);
+        for (k=0; k<6; k++) {
+            if (value[k] != v->seen_regs[i][k]) {
+                v->seen_regs[i][k] = value[k];
+                v->dirty |= CALC_VIEW_REGS;
+            }
+        }
+    }
+    for (i=0; i<CODE_NBYTES; i++) {
+        if (! (words >> (v->reg[i / 7] / REG_NWORDS) & 1))
+            continue;
+        op = calc_view_code (v, i);
+        if (op != v->seen_code[i]) {
+            v->seen_code[i] = op;
+            v->dirty |= CALC_VIEW_CODE;
+        }
+    }
+    mask = v->dirty;
+    v->dirty = 0;
+    return mask;
+}
+
+//
+// Save the state of the PLM chip.
+//
+static void plm_save (const plm_t *t, plm_state_t *s)
+{
+    int i;
+
+    for (i=0; i<REG_NWORDS; i++) {
+        s->R[i] = t->R[i];
+        s->ST[i] = t->ST[i];
+    }
+    s->S = t->S;
+    s->Q = t->Q;
+    s->carry = t->carry;
+    s->keypad_event = t->keypad_event;
+    s->keyb_x = t->keyb_x;
+    s->keyb_y = t->keyb_y;
+    s->dot = t->dot;
+    s->enable_display = t->enable_display;
+    for (i=0; i<4; i++)
+        s->command[i] = t->command >> (i * 8);
+    for (i=0; i<14; i++)
+        s->show_dot[i] = t->show_dot[i];
+}
+
+//
+// Restore the state of the PLM chip.
+//
+//
+// Check that the chip state could be left by the microcode:
+// nibbles are below 16, flags are 0 or 1, and the keypad input
+// is in the range set by calc_set_input().  Nibbles of R index
+// the ROM by the program counter, so they must not overflow.
+//
+static int plm_valid (const plm_state_t *s)
+{
+    int i;
+
+    for (i=0; i<REG_NWORDS; i++)
+        if (s->R[i] > 15 || s->ST[i] > 15)
+            return 0;
+    for (i=0; i<14; i++)
+        if (s->show_dot[i] > 1)
+            return 0;
+    return s->S <= 15 && s->Q <= 15 && s->carry <= 1 &&
+           s->keypad_event <= 1 && s->enable_display <= 1 &&
+           s->dot <= 13 && s->keyb_x <= 12 && s->keyb_y <= 9;
+}
+
+static void plm_load (plm_t *t, const plm_state_t *s)
+{
+    int i;
+
+    for (i=0; i<REG_NWORDS; i++) {
+        t->R[i] = s->R[i];
+        t->ST[i] = s->ST[i];
     }
+    t->S = s->S;
+    t->Q = s->Q;
+    t->carry = s->carry;
+    t->keypad_event = s->keypad_event;
+    t->keyb_x = s->keyb_x;
+    t->keyb_y = s->keyb_y;
+    t->dot = s->dot;
+    t->enable_display = s->enable_display;
+    t->command = s->command[0] | s->command[1] << 8 |
+        s->command[2] << 16 | (unsigned) s->command[3] << 24;
+    for (i=0; i<14; i++)
+        t->show_dot[i] = s->show_dot[i];
 }
+
+//
+// Save the state of the calculator.
+//
+void calc_save_state (calc_t *c, calc_state_t *s)
+{
+    int i;
+
+    for (i=0; i<4; i++)
+        s->magic[i] = CALC_STATE_MAGIC[i];
+    s->version = CALC_STATE_VERSION;
+    s->head = c->head;
+    s->word[0] = c->word;
+    s->word[1] = c->word >> 8;
+    plm_save (&c->ik1302, &s->ik1302);
+    plm_save (&c->ik1303, &s->ik1303);
+#ifndef MK_54
+    plm_save (&c->ik1306, &s->ik1306);
+#endif
+    for (i=0; i<RING_NWORDS * REG_NWORDS; i++)
+        s->ring[i] = c->ring[i];
+}
+
+//
+// Restore the state of the calculator.
+//
+int calc_load_state (calc_t *c, const calc_state_t *s)
+{
+    int i;
+
+    for (i=0; i<4; i++)
+        if (s->magic[i] != CALC_STATE_MAGIC[i])
+            return 0;
+    if (s->version != CALC_STATE_VERSION ||
+        s->head >= RING_NWORDS ||
+        (s->word[0] | s->word[1] << 8) >= STEP_NWORDS)
+        return 0;
+    if (! plm_valid (&s->ik1302) || ! plm_valid (&s->ik1303))
+        return 0;
+#ifndef MK_54
+    if (! plm_valid (&s->ik1306))
+        return 0;
+#endif
+    for (i=0; i<RING_NWORDS * REG_NWORDS; i++)
+        if (s->ring[i] > 15)
+            return 0;
+
+    c->head = s->head;
+    c->word = s->word[0] | s->word[1] << 8;
+    plm_load (&c->ik1302, &s->ik1302);
+    plm_load (&c->ik1303, &s->ik1303);
+#ifndef MK_54
+    plm_load (&c->ik1306, &s->ik1306);
+#endif
+    for (i=0; i<RING_NWORDS * REG_NWORDS; i++)
+        c->ring[i] = s->ring[i];
+    calc_ring_written (c);
+
+    // Headless mode takes the switch from c->rgd:
+    // keep the position saved in the snapshot.
+    if (c->ik1303.keyb_x >= MODE_RADIANS && c->ik1303.keyb_x <= MODE_GRADS)
+        calc_set_input (c, c->keycode, c->ik1303.keyb_x);
+    return 1;
+}
+
+#ifdef CALC_WARM_START
+static int warm_rgd (void *arg)
+{
+    return *(int*) arg;
+}
+
+static int warm_keypad (void *arg)
+{
+    return 0;
+}
+
+static void warm_display (void *arg, int i, int digit, int dot)
+{
+}
+
+//
+// Start the calculator from the image after power on.
+// The image is computed once, by the first thread which needs it.
+//
+void calc_warm_start (calc_t *c, int rgd)
+{
+    static const calc_callbacks_t callbacks = {
+        warm_display, warm_rgd, warm_keypad, 0,
+    };
+    static calc_state_t image [3];
+    static unsigned char ready [3];
+    unsigned mode = rgd - MODE_RADIANS;
+
+    if (mode >= 3)
+        mode = MODE_DEGREES - MODE_RADIANS;
+    if (lazy_start (&ready[mode])) {
+        calc_t t;
+
+        rgd = MODE_RADIANS + mode;
+        calc_init (&t, &callbacks, &rgd);
+        calc_step (&t);
+        calc_save_state (&t, &image[mode]);
+        lazy_done (&ready[mode]);
+    }
+    calc_load_state (c, &image[mode]);
+}
+#endif
@@ -35,94 +35,249 @@
 // Specialized PLM chips К145ИК130x.
 //
 #define REG_NWORDS  42                  // Number of words in data register
+#define PLM_NUCMDS  68                  // Number of micro-instructions
+#define STEP_NWORDS 560                 // Number of words in calc_step()
 
+//
+// Micro-instruction, decoded for fast execution.
+// Sources of alpha and beta are stored as 4-bit masks, one nibble
+// per source: alpha = R, M, ST, ~R, S, constant, C10 (low to high),
+// beta = S, ~S, Q, constant.  Field op contains the rest of
+// the micro-instruction bits, starting from UCMD_GAMMA_CARRY.
+//
+typedef struct {
+    unsigned alpha;                     // Masks for alpha sources
+    unsigned short beta;                // Masks for beta sources
+    unsigned short op;                  // Gamma and register updates
+} plm_ucmd_t;
+
+#define UCMD_OP(x)  ((x) >> 12)         // Convert UCMD_* value to op field
+
+//
+// Decode a micro-instruction at compile time: ROM tables are
+// initialized with this macro, and stay in flash memory.
+//
+#define PLM_UCMD(x) { PLM_ALPHA(x), PLM_BETA(x), UCMD_OP(x) }
+
+#define PLM_ALPHA(x) ( \
+    ((x) & UCMD_ALPHA_R   ? 0xf       : 0) | \
+    ((x) & UCMD_ALPHA_M   ? 0xf << 4  : 0) | \
+    ((x) & UCMD_ALPHA_ST  ? 0xf << 8  : 0) | \
+    ((x) & UCMD_ALPHA_NR  ? 0xf << 12 : 0) | \
+    ((x) & UCMD_ALPHA_S   ? 0xf << 16 : 0) | \
+    ((x) & UCMD_ALPHA_4   ? 4 << 20   : 0) | \
+    ((x) & UCMD_ALPHA_C10 ? 0xa << 24 : 0))
+
+#define PLM_BETA(x) ( \
+    ((x) & UCMD_BETA_S    ? 0xf       : 0) | \
+    ((x) & UCMD_BETA_NS   ? 0xf << 4  : 0) | \
+    ((x) & UCMD_BETA_Q    ? 0xf << 8  : 0) | \
+    ((x) & UCMD_BETA_6    ? 6 << 12   : 0) | \
+    ((x) & UCMD_BETA_1    ? 1 << 12   : 0))
+
+//
+// Cache of micro-instruction addresses per command needs 33 kbytes
+// of RAM, so it is disabled on pic32mx1/mx2 with 8 kbytes.
+//
+#ifndef PIC32MX2
+#define PLM_TRACE_CACHE
+#endif
+#define PLM_NCMDS   256                 // Number of commands in ROM
+
+//
+// Profiling of the microcode: every chip counts executed commands
+// and micro-instructions, and the calculator counts words spent
+// by user instructions.  Counters slow down the simulation,
+// so they are enabled only in a build with -DPLM_PROFILE.
+//
+//#define PLM_PROFILE
+
+//
+// Flag in the trace entry: micro-instruction address
+// must be incremented when carry is clear.
+//
+#define TRACE_NCARRY 0x80
+
+//
+// Tables built on first use are shared between threads.  Only
+// the thread which has moved the state from LAZY_EMPTY to LAZY_BUSY
+// writes the table; other threads wait until it is ready.
+//
+#define LAZY_EMPTY  0                   // Table is not built
+#define LAZY_BUSY   1                   // Table is being written
+#define LAZY_READY  2                   // Table can be used
+
+//
+// Return 1 when the caller must build the table,
+// and then call lazy_done(), or 0 when it is ready.
+//
+static inline int lazy_start (unsigned char *state)
+{
+    unsigned char empty = LAZY_EMPTY;
+
+    if (__atomic_load_n (state, __ATOMIC_ACQUIRE) == LAZY_READY)
+        return 0;
+    if (__atomic_compare_exchange_n (state, &empty, LAZY_BUSY, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        return 1;
+
+    // Built by another thread: wait for it.
+    while (__atomic_load_n (state, __ATOMIC_ACQUIRE) != LAZY_READY)
+        continue;
+    return 0;
+}
+
+static inline void lazy_done (unsigned char *state)
+{
+    __atomic_store_n (state, LAZY_READY, __ATOMIC_RELEASE);
+}
+
+//
+// ROM contents of the PLM chip, shared by all chips using
+// the same ROM.  Traces are filled on first execution
+// of every command.
+//
+typedef struct {
+    const plm_ucmd_t *ucmd;             // Decoded micro-instructions
+    const unsigned *cmd_rom;            // Instructions
+    const unsigned char *prog_rom;      // Program
+#ifdef PLM_TRACE_CACHE
+    unsigned char traced [PLM_NCMDS];   // State of the trace, LAZY_*
+    unsigned char trace [PLM_NCMDS] [REG_NWORDS]; // Micro-instruction addresses
+#endif
+} plm_rom_t;
+
+//
+// State of the PLM chip.  Register M is not here: it is a word
+// of the memory ring, see below.
+//
 typedef struct {
-    unsigned input;                     // Input word
-    unsigned output;                    // Output word
     unsigned char R [REG_NWORDS];       // R register
-    unsigned char M [REG_NWORDS];       // M register
     unsigned char ST [REG_NWORDS];      // ST register
     unsigned S;
     unsigned Q;
     unsigned carry;
     unsigned keypad_event;
-    unsigned opcode;
     unsigned keyb_x;
     unsigned keyb_y;
     unsigned dot;
     unsigned command;
     unsigned enable_display;
     unsigned char show_dot [14];
-    const unsigned *inst_rom;           // Micro-instructions
+    const plm_ucmd_t *ucmd;             // Decoded micro-instructions
     const unsigned *cmd_rom;            // Instructions
     const unsigned char *prog_rom;      // Program
+#ifdef PLM_TRACE_CACHE
+    plm_rom_t *rom;                     // ROM with trace cache
+    const unsigned char *trace;         // Trace of the current command
+#endif
+#ifdef PLM_PROFILE
+    unsigned long cmd_count [PLM_NCMDS]; // Commands executed, by address
+    unsigned long ucmd_count [PLM_NUCMDS]; // Micro-instructions executed
+#endif
 } plm_t;
 
 //
 // Initialize the PLM data structure.
 //
-void plm_init (plm_t *t, const unsigned inst_rom[],
-    const unsigned cmd_rom[], const unsigned char prog_rom[]);
+void plm_init (plm_t *t, plm_rom_t *rom);
 
 //
-// Simulate one cycle of the PLM chip.
+// Simulate one cycle of the PLM chip, with a given M register.
+// Return nonzero when the contents of M has changed.
 //
-void plm_step (plm_t *t, unsigned cycle);
+unsigned plm_step (plm_t *t, unsigned char M[], unsigned cycle);
 
 //
-// FIFO serial memory chip К145ИР2.
+// Simulate one word (42 cycles) of the PLM chip, with a given
+// M register.  Return nonzero when the contents of M has changed.
 //
-#define FIFO_NWORDS (6*REG_NWORDS)      // Number of words in FIFO chip
-
-typedef struct {
-    unsigned input;                     // Input word
-    unsigned output;                    // Output word
-    unsigned cycle;                     // Cycle counter
-    unsigned char data [FIFO_NWORDS];   // FIFO memory
-} fifo_t;
+unsigned plm_run_word (plm_t *t, unsigned char M[]);
 
+#ifdef PLM_TRACE_CACHE
 //
-// Initialize the FIFO register data structure.
+// Get a sequence of micro-instruction addresses for the command
+// at a given address of command ROM.
 //
-void fifo_init (fifo_t *t);
+const unsigned char *plm_trace (plm_rom_t *rom, unsigned pc);
+#endif
 
 //
-// Simulate one cycle of the FIFO chip.
+// Memory of the calculator is a ring of 42-nibble words: M registers
+// of the PLM chips hold one word each, and every FIFO chip К145ИР2
+// holds six words.  Every cycle, the ring shifts by one nibble.
+// A chip accesses only the nibble of the current cycle, so the shift
+// is the same as moving by one word at the end of the word.  The ring
+// is stored as one buffer: data never move, only the head does.
+// Positions of words are counted from the head, in the direction
+// opposite to the data flow.
 //
-void fifo_step (fifo_t *t);
+#define FIFO_NWORDS (6*REG_NWORDS)      // Number of words in FIFO chip
 
-//
-// Initialize the calculator.
-//
-void calc_init (void);
+#define RING_IK1302 0                   // M register of ИК1302
+#define RING_FIFO2  1                   // Second FIFO, six words
+#define RING_FIFO1  7                   // First FIFO, six words
+#ifdef MK_54
+#define RING_IK1303 13                  // M register of ИК1303
+#define RING_NWORDS 14                  // Number of words in the ring
+#else
+#define RING_IK1306 13                  // M register of ИК1306
+#define RING_IK1303 14
+#define RING_NWORDS 15
+#endif
 
 //
-// Simulate one cycle of the calculator.
-// Return 0 when stopped, or 1 when running a user program.
-// Call calc_keypad(), calc_rgd() and calc_display functions,
-// supplied by user.
+// Get the address of a word in the ring by position.
 //
-int calc_step (void);
+#define RING_WORD(c, pos) \
+    ((c)->ring + ((c)->head + (pos)) % RING_NWORDS * REG_NWORDS)
 
 //
-// User function: show one digit on the LED display.
+// Functions supplied by user, called by the simulator.
+// Every function gets the user argument, given to calc_init().
 //
-extern void calc_display (int i, int digit, int dot);
+typedef struct {
+    //
+    // Show one digit on the LED display.
+    //
+    void (*display) (void *arg, int i, int digit, int dot);
 
-//
-// User function: poll the radians/grads/degrees switch.
-//
-extern int calc_rgd(void);
+    //
+    // Poll the radians/grads/degrees switch.  Can be zero:
+    // then the position is set by calc_set_input().
+    //
+    int (*rgd) (void *arg);
+
+    //
+    // Poll the keypad.
+    // Return the keycode value.  Can be zero: then the key
+    // is set by calc_set_input().
+    //
+    int (*keypad) (void *arg);
+
+    //
+    // Poll optional peripherals, like USB port, once per
+    // a given number of words, see calc_set_poll_quantum().
+    // It is called between words: plm_run_word() runs all 42 cycles
+    // of a word at once, so there are at most STEP_NWORDS calls
+    // per calc_step(), not 42 times as many, one per cycle.
+    // Can be zero.
+    //
+    void (*poll) (void *arg);
+
+    //
+    // Get the whole display, as shown digit by digit during the step,
+    // once per step when it has changed.  Digits and dots are coded
+    // as by calc_get_display().  Can be zero.  With this function,
+    // display() can be zero.
+    //
+    void (*frame) (void *arg, const unsigned char digit[12],
+        const unsigned char dot[12]);
+} calc_callbacks_t;
 
 #define MODE_RADIANS    10
 #define MODE_DEGREES    11
 #define MODE_GRADS      12
-
-//
-// User function: poll the keypad.
-// Return the keycode value.
-//
-extern int calc_keypad(void);
                             //  Key Function
 #define KEY_0       0x21    //  0   10^x    НОП
 #define KEY_1       0x31    //  1   e^x
@@ -155,32 +310,475 @@ extern int calc_keypad(void);
 #define KEY_K       0xa9    //  K
 #define KEY_F       0xb9    //  F
 
+#ifdef PLM_PROFILE
+//
+// Cost of user instructions, in words: from the fetch of an instruction
+// to the fetch of the next one, or to the stop of the program.
+//
+typedef struct {
+    unsigned long words [256];          // Words spent, by opcode
+    unsigned long count [256];          // Instructions executed, by opcode
+    int op;                             // Instruction in progress, or -1
+    int fetch_jump;                     // Next fetch is the address byte
+    int running;                        // Run mode seen since the fetch
+    unsigned long nwords;               // Words since the fetch
+} calc_profile_t;
+#endif
+
+//
+// State of the calculator.
+// MK-54 consists of two PLM chips ИК1302 and ИК1303,
+// and two serial FIFOs К145ИР2.  MK-61 has an additional
+// chip ИК1306 in series.  Memory of all chips is one ring.
+// All chips are kept in one block, aligned to a cache line;
+// there are no global variables, so any number of calculators
+// can be simulated at once.
+//
+typedef struct {
+    plm_t ik1302;
+    plm_t ik1303;
+#ifndef MK_54
+    plm_t ik1306;
+#endif
+    unsigned char ring [RING_NWORDS * REG_NWORDS]; // Memory ring
+    unsigned head;                      // Index of the first word in the ring
+    unsigned ring_gen [RING_NWORDS];    // Incremented when a word changes
+    int reference_mode;                 // Use per-cycle simulation
+    unsigned word;                      // Words simulated, modulo 560
+    int fetch_jump;                     // For calc_run() and breakpoints:
+                                        // next fetch is the address byte
+                                        // of a jump
+    int nbreaks;                        // Number of breakpoints
+    int break_pc;                       // Breakpoint reached, or -1
+    unsigned char breaks [(CODE_NBYTES + 7) / 8]; // Bitmap of breakpoints
+    struct calc_watch *watches;         // Watchpoints, given by user
+    int nwatches;                       // Number of watchpoints
+    int watch_hit;                      // Watchpoint fired, or -1
+    int insn_pc;                        // Address of the instruction
+                                        // in progress, or -1
+    int headless;                       // Input from fields below, no callbacks
+    int keycode;                        // Key pressed, set by calc_set_input()
+    int rgd;                            // Switch position, set the same way
+    unsigned input_gen;                 // Incremented when input changes
+    unsigned poll_quantum;              // Words between calls of poll()
+    unsigned poll_count;                // Words since the last poll()
+    void (*trace) (void *arg, unsigned word); // Called after every word, or 0
+    unsigned char shown [12];           // Display, as shown by calc_step()
+    unsigned char frame [12];           // Display, as last given to frame()
+    const calc_callbacks_t *callbacks;  // User functions
+    void *arg;                          // Argument for user functions
+#ifdef PLM_PROFILE
+    calc_profile_t profile;             // Words per user instruction
+#endif
+} __attribute__ ((aligned (64))) calc_t;
+
+//
+// Locations in R register of ИК1302, valid at the fetch
+// of a user instruction.  Program counter is stored as two digits,
+// and also as a word of memory and an index in the word.
+// Opcode at the program counter is already fetched.
+// Return stack is a list of addresses, minus 1, as two digits,
+// with the top entry first.  Unused entries are zero after reset.
+//
+#define PC_TENS         34              // Program counter
+#define PC_UNITS        31
+#define PC_WORD         32
+#define PC_INDEX        35
+#define OPCODE_HIGH     33              // Next opcode
+#define OPCODE_LOW      30
+#define RSTACK_TENS(i)  (28 - 6*(i))    // Return stack
+#define RSTACK_UNITS(i) (25 - 6*(i))
+
+//
+// Address of the microcode command which fetches a user instruction.
+// Address of the current command is kept in R[36] and R[39].
+// The fetch is seen between words for one word only.
+//
+#define CMD_FETCH       0x06
+#define CALC_FETCH(c)   ((c)->ik1302.R[36] == CMD_FETCH && \
+                         (c)->ik1302.R[39] == 0)
+
+#define CALC_NRETURN    5               // Depth of return stack
+
+//
+// Does the microcode fetch the program twice for the instruction?
+// Jumps have an address byte, which is fetched the same way
+// as the next instruction.  В/О returns to the address byte of ПП,
+// and fetches it again.
 //
-// Poll the USB port.
+#define INSN_FETCHES_TWICE(op) ((op) >= 0x51 && (op) <= 0x5e && \
+                         (op) != 0x54 && (op) != 0x55 && (op) != 0x56)
+
+//
+// Initialize the calculator.
 //
-void calc_poll(void);
+void calc_init (calc_t *c, const calc_callbacks_t *callbacks, void *arg);
+
+//
+// Simulate one step of the calculator: STEP_NWORDS words, which is
+// 40 scans of the display, one symbol per word.
+// Return 0 when stopped, or 1 when running a user program.
+// With breakpoints set, the step ends before the instruction
+// at a breakpoint, see calc_get_break(), or after the instruction
+// which fired a watchpoint, see calc_get_watch().
+// Call keypad(), rgd(), display(), frame() and poll() functions,
+// supplied by user, unless in headless mode.  When the calculator
+// is stopped and waits for a key, words are skipped until the input
+// changes.
+//
+int calc_step (calc_t *c);
+
+//
+// Simulate one word (42 cycles) of the calculator, without polling
+// the keypad and updating the display: keys and the switch keep
+// the state from the last calc_step().  Values of registers can be
+// accessed between words, as well as between steps.
+// Return 0 when stopped, or 1 when running a user program.
+//
+int calc_step_word (calc_t *c);
+
+//
+// Press a key and release it as soon as the calculator has taken it,
+// then simulate until it is ready for the next key.  A program started
+// by the key is run until it stops.  Keypad callback is not used;
+// display, frame and switch callbacks are called as by calc_step().
+// Return the number of simulated words, or 0 when more than
+// a given limit is needed.
+//
+unsigned long calc_press_key (calc_t *c, int keycode, unsigned long limit);
+
+//
+// Advance the calculator by a given number of words, with the keys
+// and the switch as set last time.  Keypad and display are not polled.
+// When the calculator gets idle, the rest of the time is skipped.
+// Return the number of simulated words.
+//
+unsigned long calc_fast_forward (calc_t *c, unsigned long nwords);
+
+//
+// Limits for calc_run(), and the time used.
+//
+typedef struct {
+    int keycode;                        // Key to press first, or 0
+    unsigned long max_words;            // Budget of words
+    unsigned long max_insns;            // Number of instructions, or 0
+    unsigned long stable_words;         // Words of the same display, or 0
+    unsigned long words;                // Words used, 42 cycles each
+    unsigned long insns;                // Instructions executed
+} calc_run_t;
+
+#define CALC_STOPPED    0               // Program stopped, waits for a key
+#define CALC_INSNS      1               // Given number of instructions done
+#define CALC_STABLE     2               // Display has not changed
+#define CALC_BUDGET     3               // Budget of words is used up
+#define CALC_BREAK      4               // Breakpoint is reached
+#define CALC_WATCH      5               // Watchpoint has fired
 
 //
-// Read the stack: X, Y, Z, T and X1 values.
+// Simulate words, as calc_step_word(), until a stop condition holds.
+// A given key is pressed first, and released as soon as taken,
+// as by calc_press_key(): this way С/П starts the program.
+// User instructions are counted at the fetch of the next one,
+// so the calculator is left before an instruction, as well as
+// at a breakpoint or a watchpoint.  Display is compared after
+// every word, as calc_step() shows it.
+// Return the reason of the stop; words and insns are updated.
+//
+int calc_run (calc_t *c, calc_run_t *r);
+
+//
+// Get the address of the next user instruction.  Valid when
+// the calculator is stopped, and at the fetch of an instruction:
+// at a breakpoint, or when calc_run() stops on instruction count.
+//
+unsigned calc_get_pc (calc_t *c);
+
+//
+// Get the return stack: addresses of subroutine calls, which are
+// return addresses minus 1, with the top entry first.  The depth
+// is not stored: unused entries are zero after reset.  Valid
+// the same way as calc_get_pc().
+//
+void calc_get_rstack (calc_t *c, unsigned rstack[CALC_NRETURN]);
+
+//
+// Set (1) or clear (0) a breakpoint at a user address.  A program
+// stops at the fetch of the instruction, in calc_step() and
+// calc_run().  Without breakpoints, calc_step() has no overhead.
+//
+void calc_set_break (calc_t *c, unsigned addr, int on);
+
+//
+// Get the address of the breakpoint, where the last calc_step()
+// or calc_run() stopped, or -1.  Continue by calling it again.
+//
+int calc_get_break (calc_t *c);
+
+//
+// Watchpoint on a memory register or a stack value.  It fires when
+// the value is changed by a user instruction, and the new value meets
+// a condition: both must hold.  So it is triggered by an edge:
+// a value which stays negative fires once, when it becomes negative,
+// and again only when the next change leaves it negative.
+// Values are compared at the fetch of every instruction, in place
+// in the memory ring.  Stack values are kept in memory only
+// when the microcode has stored them, so a change of X can be
+// noticed after the next instructions.
+//
+typedef struct calc_watch {
+    int reg;                            // Register below DATA_NREGS,
+                                        // or CALC_WATCH_X1...CALC_WATCH_T
+    int cond;                           // Condition: CALC_WATCH_CHANGE...
+    int fired;                          // Set when fired, cleared by user
+    unsigned pc;                        // Instruction, which changed it
+    unsigned short offset;              // Location of the value in the ring
+    unsigned char value [6];            // Value seen last time
+} calc_watch_t;
+
+#define CALC_WATCH_X1       16          // Stack values, as calc_get_stack()
+#define CALC_WATCH_X        17
+#define CALC_WATCH_Y        18
+#define CALC_WATCH_Z        19
+#define CALC_WATCH_T        20
+
+#define CALC_WATCH_CHANGE   0           // Any change
+#define CALC_WATCH_NEG      1           // Changed to a negative value
+#define CALC_WATCH_ZERO     2           // Changed to zero
+
+//
+// Set an array of watchpoints, or remove them with zero count.
+// Fields reg and cond must be filled, the rest is initialized
+// with current values.  The array must stay valid while in use.
+// Like breakpoints, watchpoints switch calc_step() to
+// the kernel which checks every instruction.
+// Return 0, with no watchpoints set, when a register
+// or a condition is out of range.
+//
+int calc_set_watches (calc_t *c, calc_watch_t *w, int n);
+
+//
+// Get the index of the watchpoint, which has stopped the last
+// calc_step() or calc_run(), or -1.  When several have fired
+// at once, the first one is given: see their fired flags.
+//
+int calc_get_watch (calc_t *c);
+
+#ifdef PLM_PROFILE
+//
+// Clear the counters of the profile: commands and micro-instructions
+// of every chip, and words of user instructions.  Words skipped
+// in the idle loop are not counted.
+//
+void calc_profile_clear (calc_t *c);
+#endif
+
+//
+// Select the simulation mode: per-cycle reference (1),
+// or word-level kernels (0, default).  Both give the same results.
+//
+void calc_set_reference (calc_t *c, int on);
+
+//
+// Select the headless mode (1): keypad, switch, display and poll
+// callbacks are not called, and callbacks can be zero.  Input is
+// set by calc_set_input(), and the display is read by
+// calc_get_display() when needed.  Default is 0.
+//
+void calc_set_headless (calc_t *c, int on);
+
+//
+// Set the key pressed (0 for none), and the position
+// of radians/grads/degrees switch.  Used in headless mode, and
+// instead of keypad() and rgd() callbacks, when they are zero.
+// The generation counter input_gen is incremented on every change,
+// and the input is taken by the next word.
+//
+void calc_set_input (calc_t *c, int keycode, int rgd);
+
+//
+// Set how often poll() callback is called: once per a given
+// number of simulated words.  Default is 1, every word;
+// STEP_NWORDS is once per calc_step().  The latency of poll()
+// grows with the quantum: choose it by the time of a word
+// on the target.
+//
+void calc_set_poll_quantum (calc_t *c, unsigned nwords);
+
+//
+// Set a function, called after every simulated word with
+// the number of the word in calc_step(), for debug trace.
+// Zero disables the trace.
+//
+void calc_set_trace (calc_t *c, void (*trace) (void *arg, unsigned word));
+
+//
+// Decode the display: 12 digits and decimal dots, exponent first.
+// Digits are 0-9, 10-14 for symbols "-LCRE", and 15 for blank.
+// In run mode, the display is blank, with all dots on.
+//
+void calc_get_display (calc_t *c, unsigned char digit[12],
+    unsigned char dot[12]);
+
+//
+// Read the stack: X1, X, Y, Z and T values.
 // Each value contains 12 bcd digits stored as six bytes.
 //
-void calc_get_stack (unsigned char stack[5][6]);
+void calc_get_stack (calc_t *c, unsigned char stack[5][6]);
+
+//
+// Write the stack: X1, X, Y, Z and T values.
+//
+void calc_set_stack (calc_t *c, unsigned char stack[5][6]);
 
 //
 // Read the memory registers 0-9, A-D.
 // Each value contains 12 bcd digits stored as six bytes.
 //
-void calc_get_regs (unsigned char reg[][6]);
+void calc_get_regs (calc_t *c, unsigned char reg[][6]);
+
+//
+// Write the memory registers.
+//
+void calc_set_regs (calc_t *c, unsigned char reg[][6]);
 
 //
 // Read the program code.
 //
-void calc_get_code (unsigned char code[]);
+void calc_get_code (calc_t *c, unsigned char code[]);
 
 //
 // Update the program code.
 //
-void calc_write_code (unsigned char code[]);
+void calc_write_code (calc_t *c, unsigned char code[]);
+
+//
+// View of values in the memory ring: one register, stack value
+// or instruction is read at a time, without copying the rest.
+// Locations are computed once by calc_view_init(): data stay
+// at the same place in the ring.  Changes are tracked by words
+// of the ring: the word kernel and calc_set_*() functions count
+// writes which modify a word, and only values in such words are
+// compared with the ones seen last time.
+//
+typedef struct {
+    const calc_t *calc;
+    unsigned short reg [DATA_NREGS];    // Offsets of register words
+    unsigned short stack [5];           // Offsets of stack words
+    unsigned dirty;                     // Changes not reported yet
+    unsigned seen_gen [RING_NWORDS];    // Changes of ring words seen
+    unsigned char seen_stack [5][6];    // Values seen last time
+    unsigned char seen_regs [DATA_NREGS][6];
+    unsigned char seen_code [CODE_NBYTES];
+} calc_view_t;
+
+#define CALC_VIEW_STACK 1               // Stack has changed
+#define CALC_VIEW_REGS  2               // Memory registers have changed
+#define CALC_VIEW_CODE  4               // Program has changed
+
+//
+// Initialize the view of a calculator.  Everything is reported
+// as changed by the first calc_view_changed().
+//
+void calc_view_init (calc_view_t *v, const calc_t *c);
+
+//
+// Read one value of the stack: 0 - X1, 1 - X, 2 - Y, 3 - Z, 4 - T,
+// or a memory register, as 12 bcd digits stored in six bytes.
+//
+void calc_view_stack (const calc_view_t *v, int i, unsigned char value[6]);
+void calc_view_reg (const calc_view_t *v, int i, unsigned char value[6]);
+
+//
+// Read one instruction of the program.
+//
+unsigned calc_view_code (const calc_view_t *v, int addr);
+
+//
+// Tell what has changed since the last call: a mask of
+// CALC_VIEW_STACK, CALC_VIEW_REGS and CALC_VIEW_CODE bits.
+//
+unsigned calc_view_changed (calc_view_t *v);
+
+//
+// Snapshot of the calculator state, taken between words.
+// All fields are bytes, so the snapshot does not depend
+// on the host and can be written to a file as is.
+// Pointers to ROM and callbacks are not saved: traces
+// of current commands are fetched again on the next word.
+//
+#ifdef MK_54
+#define CALC_STATE_MAGIC    "MK54"
+#else
+#define CALC_STATE_MAGIC    "MK61"
+#endif
+#define CALC_STATE_VERSION  1
+
+typedef struct {
+    unsigned char R [REG_NWORDS];
+    unsigned char ST [REG_NWORDS];
+    unsigned char S;
+    unsigned char Q;
+    unsigned char carry;
+    unsigned char keypad_event;
+    unsigned char keyb_x;
+    unsigned char keyb_y;
+    unsigned char dot;
+    unsigned char enable_display;
+    unsigned char command [4];          // Little endian
+    unsigned char show_dot [14];
+} plm_state_t;
+
+typedef struct {
+    char magic [4];                     // Model: MK61 or MK54
+    unsigned char version;              // Format of the snapshot
+    unsigned char head;                 // Head of the memory ring
+    unsigned char word [2];             // Word counter, little endian
+    plm_state_t ik1302;
+    plm_state_t ik1303;
+#ifndef MK_54
+    plm_state_t ik1306;
+#endif
+    unsigned char ring [RING_NWORDS * REG_NWORDS];
+} calc_state_t;
+
+//
+// Save the state of the calculator.
+//
+void calc_save_state (calc_t *c, calc_state_t *s);
+
+//
+// Restore the state of a calculator, initialized by calc_init().
+// Return 0 when the snapshot has a wrong model or version,
+// or holds values which the microcode never leaves: nibbles
+// above 15, flags above 1, keypad input out of range.
+// The calculator is not modified in this case.
+// The position of the switch is also set as by calc_set_input().
+//
+int calc_load_state (calc_t *c, const calc_state_t *s);
+
+//
+// Images of the calculator after power on need 3 kbytes of RAM,
+// so they are disabled on pic32mx1/mx2 with 8 kbytes.
+//
+#ifndef PIC32MX2
+#define CALC_WARM_START
+
+//
+// Bring the calculator, initialized by calc_init(), to the state
+// after the first calc_step(): ready for input, with keys released
+// and a given position of the radians/grads/degrees switch.
+// The state is computed once per switch position, and then copied.
+//
+void calc_warm_start (calc_t *c, int rgd);
+#endif
+
+//
+// Detection of the idle loop keeps two snapshots on the stack,
+// so it is disabled on pic32mx1/mx2 as well.
+//
+#ifndef PIC32MX2
+#define CALC_IDLE_SKIP
+#endif
 
 //
 // Microinstructions
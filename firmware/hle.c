@@ -0,0 +1,940 @@
+/*
+ * Fast simulator of MK-61 programs at the level of instructions.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "calc.h"
+#include "hle.h"
+
+//
+// Stack registers, as in calc_get_stack().
+//
+#define X1  0
+#define X   1
+#define Y   2
+#define Z   3
+#define T   4
+
+//
+// Opcodes.
+//
+#define OP_POINT    0x0a    // .
+#define OP_NEG      0x0b    // /-/
+#define OP_CLEAR    0x0d    // Cx
+#define OP_ENTER    0x0e    // B^
+#define OP_LASTX    0x0f    // F Bx
+#define OP_ADD      0x10    // +
+#define OP_SUB      0x11    // -
+#define OP_MUL      0x12    // *
+#define OP_DIV      0x13    // /
+#define OP_XY       0x14    // <->
+#define OP_EXP10    0x15    // F 10^x
+#define OP_EXP      0x16    // F e^x
+#define OP_LG       0x17    // F lg
+#define OP_LN       0x18    // F ln
+#define OP_ASIN     0x19    // F arcsin
+#define OP_ACOS     0x1a    // F arccos
+#define OP_ATAN     0x1b    // F arctg
+#define OP_SIN      0x1c    // F sin
+#define OP_COS      0x1d    // F cos
+#define OP_TAN      0x1e    // F tg
+#define OP_PI       0x20    // F pi
+#define OP_SQRT     0x21    // F sqrt
+#define OP_SQUARE   0x22    // F x^2
+#define OP_RECIP    0x23    // F 1/x
+#define OP_ROT      0x25    // F rotate
+#define OP_ABS      0x31    // K |x|
+#define OP_SIGN     0x32    // K ЗН
+#define OP_INT      0x34    // K [x]
+#define OP_FRAC     0x35    // K {x}
+#define OP_STOPGO   0x50    // С/П
+#define OP_GOTO     0x51    // БП
+#define OP_RET      0x52    // В/О
+#define OP_CALL     0x53    // ПП
+#define OP_NOP      0x54    // K НОП
+#define OP_IFNZ     0x57    // F x!=0
+#define OP_LOOP2    0x58    // F L2
+#define OP_IFGE     0x59    // F x>=0
+#define OP_LOOP3    0x5a    // F L3
+#define OP_LOOP1    0x5b    // F L1
+#define OP_IFLT     0x5c    // F x<0
+#define OP_LOOP0    0x5d    // F L0
+#define OP_IFZ      0x5e    // F x=0
+
+//
+// Unpacked value.
+//
+typedef struct {
+    int neg;                            // Mantissa is negative
+    int exp;                            // Exponent of the first digit
+    unsigned long long mant;            // Eight digits of mantissa
+} num_t;
+
+static const unsigned long long power10[18] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL,
+};
+
+static const unsigned char value_pi[6] = { 0x00, 0x00, 0x13, 0x14, 0x95, 0x62 };
+
+//
+// Get a nibble of the value: 0-2 exponent, 3 sign, 4-11 mantissa.
+//
+static inline unsigned nibble (const unsigned char v[6], int i)
+{
+    return (i & 1) ? (v[i/2] >> 4) : (v[i/2] & 15);
+}
+
+//
+// Unpack a value.  Return 0 when it has non-decimal digits.
+//
+static int decode (const unsigned char v[6], num_t *n)
+{
+    unsigned sexp = nibble (v, 0), e1 = nibble (v, 1), e2 = nibble (v, 2);
+    unsigned sign = nibble (v, 3), digit;
+    int i;
+
+    if ((sexp != 0 && sexp != 9) || (sign != 0 && sign != 9) ||
+        e1 > 9 || e2 > 9)
+        return 0;
+    n->exp = e1*10 + e2;
+    if (sexp == 9) {
+        if (n->exp == 0)
+            return 0;
+        n->exp -= 100;
+    }
+    n->neg = (sign == 9);
+    n->mant = 0;
+    for (i=4; i<12; i++) {
+        digit = nibble (v, i);
+        if (digit > 9)
+            return 0;
+        n->mant = n->mant*10 + digit;
+    }
+    return 1;
+}
+
+//
+// Shift the mantissa left to get a nonzero first digit.
+//
+static void normalize (num_t *n)
+{
+    if (n->mant == 0) {
+        n->neg = 0;
+        n->exp = 0;
+        return;
+    }
+    while (n->mant < power10[7]) {
+        n->mant *= 10;
+        n->exp--;
+    }
+}
+
+//
+// Pack a normalized value from a sign and mant*10^scale.
+// Return 0 when the value does not fit exactly.
+//
+static int encode (unsigned char v[6], int neg, unsigned long long mant,
+    int scale)
+{
+    unsigned char nib[12];
+    int exp, i;
+
+    if (mant == 0) {
+        memset (v, 0, 6);
+        return 1;
+    }
+    while (mant >= power10[8]) {
+        if (mant % 10 != 0)
+            return 0;
+        mant /= 10;
+        scale++;
+    }
+    while (mant < power10[7]) {
+        mant *= 10;
+        scale--;
+    }
+    exp = scale + 7;
+    if (exp < -99 || exp > 99)
+        return 0;
+
+    nib[0] = (exp < 0) ? 9 : 0;
+    if (exp < 0)
+        exp += 100;
+    nib[1] = exp / 10;
+    nib[2] = exp % 10;
+    nib[3] = neg ? 9 : 0;
+    for (i=11; i>=4; i--) {
+        nib[i] = mant % 10;
+        mant /= 10;
+    }
+    for (i=0; i<6; i++)
+        v[i] = nib[2*i] | nib[2*i+1] << 4;
+    return 1;
+}
+
+//
+// Pack an integer the way indirect addressing leaves it
+// in a register: not normalized, with exponent 7.
+//
+static void encode_int (unsigned char v[6], unsigned long mant)
+{
+    int i;
+
+    v[0] = 0;
+    v[1] = 7;
+    for (i=5; i>=2; i--) {
+        v[i] = mant % 10 << 4;
+        mant /= 10;
+        v[i] |= mant % 10;
+        mant /= 10;
+    }
+}
+
+//
+// Addition.  The microcode shifts the operand with the lesser
+// exponent right, rounding at every step, so the result is exact
+// only when no nonzero digits are shifted out.
+//
+static int add (unsigned char r[6], const num_t *a, const num_t *b)
+{
+    num_t p = *a, q = *b, t;
+    unsigned long long qmant, mant;
+    int d, neg;
+
+    normalize (&p);
+    normalize (&q);
+    if (q.mant == 0)
+        return encode (r, p.neg, p.mant, p.exp - 7);
+    if (p.mant == 0)
+        return encode (r, q.neg, q.mant, q.exp - 7);
+    if (p.exp < q.exp) {
+        t = p;
+        p = q;
+        q = t;
+    }
+    d = p.exp - q.exp;
+    if (d >= 8 || q.mant % power10[d] != 0)
+        return 0;
+    qmant = q.mant / power10[d];
+
+    if (p.neg == q.neg) {
+        mant = p.mant + qmant;
+        neg = p.neg;
+    } else if (p.mant >= qmant) {
+        mant = p.mant - qmant;
+        neg = p.neg;
+    } else {
+        mant = qmant - p.mant;
+        neg = q.neg;
+    }
+    return encode (r, neg, mant, p.exp - 7);
+}
+
+//
+// Multiplication: the exact product must fit in eight digits.
+//
+static int mul (unsigned char r[6], const num_t *a, const num_t *b)
+{
+    num_t p = *a, q = *b;
+
+    normalize (&p);
+    normalize (&q);
+    if (p.mant == 0 || q.mant == 0)
+        return encode (r, 0, 0, 0);
+    return encode (r, p.neg ^ q.neg, p.mant * q.mant,
+        p.exp - 7 + q.exp - 7);
+}
+
+//
+// Division: the exact quotient must fit in eight digits.
+//
+static int divide (unsigned char r[6], const num_t *a, const num_t *b)
+{
+    num_t p = *a, q = *b;
+    unsigned long long n;
+    int k;
+
+    normalize (&p);
+    normalize (&q);
+    if (q.mant == 0)
+        return 0;
+    if (p.mant == 0)
+        return encode (r, 0, 0, 0);
+    for (k=0; k<=9; k++) {
+        n = p.mant * power10[k];
+        if (n % q.mant == 0)
+            return encode (r, p.neg ^ q.neg, n / q.mant,
+                p.exp - q.exp - k);
+    }
+    return 0;
+}
+
+//
+// Integer square root.
+//
+static unsigned long long isqrt (unsigned long long n)
+{
+    unsigned long long root = 0, bit = 1ULL << 62;
+
+    while (bit > n)
+        bit >>= 2;
+    while (bit != 0) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else
+            root >>= 1;
+        bit >>= 2;
+    }
+    return root;
+}
+
+//
+// Square root.  The microcode computes it digit by digit,
+// so the result is truncated to eight digits.
+//
+static int square_root (unsigned char r[6], const num_t *a)
+{
+    num_t p = *a;
+    int scale, shift;
+
+    normalize (&p);
+    if (p.mant == 0)
+        return encode (r, 0, 0, 0);
+    if (p.neg)
+        return 0;
+
+    // Extend the mantissa to 15 or 16 digits, to get
+    // an even exponent and 8 digits of the root.
+    scale = p.exp - 7;
+    shift = (scale & 1) ? 7 : 8;
+    return encode (r, 0, isqrt (p.mant * power10[shift]),
+        (scale - shift) / 2);
+}
+
+//
+// Get an integer value.  Return 0 when the value has a fraction.
+//
+static int integer_value (const num_t *a, long *result)
+{
+    num_t p = *a;
+    long n;
+
+    normalize (&p);
+    if (p.mant == 0) {
+        *result = 0;
+        return 1;
+    }
+    if (p.exp < 0 || p.exp > 7 || p.mant % power10[7 - p.exp] != 0)
+        return 0;
+    n = p.mant / power10[7 - p.exp];
+    *result = p.neg ? -n : n;
+    return 1;
+}
+
+//
+// Compute a function of X.  Transcendental functions are exact
+// only for a few arguments, like lg of a power of 10: it is
+// a shortcut for special values, not a port of the microcode.
+//
+int hle_exact_function (unsigned op, const unsigned char x[6], int rgd,
+    unsigned char result[6])
+{
+    num_t a;
+    long n;
+    int right_angle = (rgd == MODE_DEGREES) ? 90 :
+                      (rgd == MODE_GRADS) ? 100 : 0;
+
+    if (! decode (x, &a))
+        return 0;
+    normalize (&a);
+    switch (op) {
+    case OP_EXP10:
+        if (! integer_value (&a, &n) || n < -99 || n > 99)
+            return 0;
+        return encode (result, 0, 1, n);
+
+    case OP_EXP:
+        if (a.mant != 0)
+            return 0;
+        return encode (result, 0, 1, 0);
+
+    case OP_LG:
+        // Exact only for small powers of 10.
+        if (a.neg || a.mant != power10[7] || abs (a.exp) > 3)
+            return 0;
+        return encode (result, a.exp < 0, abs (a.exp), 0);
+
+    case OP_LN:
+        if (a.neg || a.mant != power10[7] || a.exp != 0)
+            return 0;
+        return encode (result, 0, 0, 0);
+
+    case OP_SIN:
+        if (a.mant == 0)
+            return encode (result, 0, 0, 0);
+        if (! right_angle || ! integer_value (&a, &n) ||
+            (n != right_angle && n != -right_angle))
+            return 0;
+        return encode (result, n < 0, 1, 0);
+
+    case OP_COS:
+        if (a.mant == 0)
+            return encode (result, 0, 1, 0);
+        if (! right_angle || ! integer_value (&a, &n) ||
+            (n != right_angle && n != -right_angle))
+            return 0;
+        return encode (result, 0, 0, 0);
+
+    case OP_TAN:
+        if (a.mant != 0)
+            return 0;
+        return encode (result, 0, 0, 0);
+
+    case OP_ASIN:
+        // Zero result of inverse functions has a hidden exponent.
+        if (! right_angle || ! integer_value (&a, &n) ||
+            (n != 1 && n != -1))
+            return 0;
+        return encode (result, n < 0, right_angle, 0);
+
+    case OP_ACOS:
+        if (! right_angle || ! integer_value (&a, &n) ||
+            (n != 0 && n != -1))
+            return 0;
+        return encode (result, 0, (1 - n) * right_angle, 0);
+
+    case OP_SQRT:
+        return square_root (result, &a);
+    }
+    return 0;
+}
+
+//
+// Get the integer part of a register for indirect addressing.
+// Registers 0-3 are decremented, 4-6 incremented, and the result
+// is stored back as an integer: new value of the register is
+// placed to v.  Return 0 for unsupported values.
+//
+static int indirect (hle_t *h, unsigned n, unsigned long *result,
+    unsigned char v[6])
+{
+    num_t r;
+    unsigned long k = 0;
+
+    if (n >= DATA_NREGS || ! decode (h->regs[n], &r))
+        return 0;
+    if (r.mant != 0) {
+        if (r.neg || r.exp < 0 || r.exp > 7)
+            return 0;
+        k = r.mant / power10 [7 - r.exp];
+    }
+    if (n < 4) {
+        if (k == 0)
+            return 0;
+        k--;
+    } else if (n < 7) {
+        if (k >= power10[8] - 1)
+            return 0;
+        k++;
+    }
+    encode_int (v, k);
+    *result = k;
+    return 1;
+}
+
+//
+// Convert the address byte of a jump to an address.
+//
+static int jump_address (hle_t *h, unsigned *addr)
+{
+    unsigned byte, hi, lo;
+
+    if (h->pc + 1 >= CODE_NBYTES)
+        return 0;
+    byte = h->code [h->pc + 1];
+    hi = byte >> 4;
+    lo = byte & 15;
+    if (lo > 9 || hi*10 + lo >= CODE_NBYTES)
+        return 0;
+    *addr = hi*10 + lo;
+    return 1;
+}
+
+//
+// Evaluate the condition of a branch.  Return -1 when X is not a number.
+//
+static int condition (hle_t *h, unsigned op)
+{
+    num_t x;
+
+    if (! decode (h->stack[X], &x))
+        return -1;
+    if (x.mant == 0 && x.neg)
+        return -1;
+    switch (op) {
+    case OP_IFNZ: return x.mant != 0;
+    case OP_IFGE: return ! x.neg;
+    case OP_IFLT: return x.neg;
+    case OP_IFZ:  return x.mant == 0;
+    }
+    return -1;
+}
+
+//
+// Push the return address.  Overflow of the stack
+// is not supported.
+//
+static int push_return (hle_t *h, unsigned addr)
+{
+    int i;
+
+    if (h->nreturn >= HLE_NRETURN)
+        return 0;
+    for (i=HLE_NRETURN-1; i>0; i--)
+        h->rstack[i] = h->rstack[i-1];
+    h->rstack[0] = addr;
+    h->nreturn++;
+    return 1;
+}
+
+//
+// Pop the return address.  The microcode shifts the digits
+// of the stack, and the low digit of the bottom entry is repeated.
+//
+static unsigned pop_return (hle_t *h)
+{
+    unsigned addr = h->rstack[0];
+    unsigned last = h->rstack[HLE_NRETURN-1] % 10;
+    int i;
+
+    for (i=0; i<HLE_NRETURN-1; i++)
+        h->rstack[i] = h->rstack[i+1];
+    h->rstack[HLE_NRETURN-1] = last * 11;
+    if (h->nreturn > 0)
+        h->nreturn--;
+    return addr;
+}
+
+//
+// Move the stack up: X is copied to Y.
+//
+static void lift (hle_t *h)
+{
+    memcpy (h->stack[T], h->stack[Z], 6);
+    memcpy (h->stack[Z], h->stack[Y], 6);
+    memcpy (h->stack[Y], h->stack[X], 6);
+}
+
+//
+// Put a value to X, as a new number.  Unlike digits,
+// the stack is lifted even after B^ or Cx.  The value is
+// normalized: integers left by indirect addressing become
+// usual numbers.  Return 0 when the value is not a number.
+//
+static int push (hle_t *h, const unsigned char v[6])
+{
+    unsigned char tmp[6];
+    num_t n;
+
+    if (! decode (v, &n))
+        return 0;
+    encode (tmp, n.neg, n.mant, n.exp - 7);
+    lift (h);
+    memcpy (h->stack[X], tmp, 6);
+    return 1;
+}
+
+//
+// Replace X by a result of a function of X.
+//
+static void result_x (hle_t *h, const unsigned char v[6])
+{
+    memcpy (h->stack[X1], h->stack[X], 6);
+    memcpy (h->stack[X], v, 6);
+}
+
+//
+// Replace X and Y by a result of an operation, and move the stack down.
+//
+static void result_xy (hle_t *h, const unsigned char v[6])
+{
+    memcpy (h->stack[X1], h->stack[X], 6);
+    memcpy (h->stack[X], v, 6);
+    memcpy (h->stack[Y], h->stack[Z], 6);
+    memcpy (h->stack[Z], h->stack[T], 6);
+}
+
+//
+// Enter a digit or a decimal point.
+//
+static int enter (hle_t *h, unsigned op)
+{
+    unsigned long mant = 0;
+    int ndigits = 0, frac = -1;
+    unsigned char v[6];
+
+    if (h->entry) {
+        mant = h->entry_mant;
+        ndigits = h->entry_ndigits;
+        frac = h->entry_frac;
+    }
+    if (op == OP_POINT) {
+        // Point before digits is not supported.
+        if (! h->entry)
+            return 0;
+        if (frac < 0)
+            frac = 0;
+    } else {
+        if (ndigits >= 8)
+            return 0;
+        mant = mant*10 + op;
+        ndigits++;
+        if (frac >= 0)
+            frac++;
+    }
+    encode (v, 0, mant, (frac > 0) ? -frac : 0);
+
+    if (! h->entry && ! h->nolift)
+        lift (h);
+    memcpy (h->stack[X], v, 6);
+    h->entry = 1;
+    h->nolift = 0;
+    h->entry_mant = mant;
+    h->entry_ndigits = ndigits;
+    h->entry_frac = frac;
+    h->pc++;
+    return 1;
+}
+
+//
+// Execute an instruction other than digit entry.
+// Return 0 when it is not supported.
+//
+static int execute (hle_t *h, unsigned op)
+{
+    unsigned char v[6];
+    unsigned next = h->pc + 1, addr;
+    unsigned long k;
+    num_t x, y;
+    int nolift = 0, cond, i;
+
+    switch (op) {
+    case OP_NEG:
+        if (! decode (h->stack[X], &x) || x.mant < power10[7])
+            return 0;
+        h->stack[X][1] ^= 0x90;
+
+        // Sign of an entered number finishes the entry,
+        // and next digit replaces X.
+        if (h->entry)
+            nolift = 1;
+        break;
+
+    case OP_CLEAR:
+        // Clearing an entered number means the next digit
+        // replaces X.  Otherwise the lift is not changed.
+        memset (h->stack[X], 0, 6);
+        nolift = h->entry || h->nolift;
+        break;
+
+    case OP_ENTER:
+        lift (h);
+        nolift = 1;
+        break;
+
+    case OP_LASTX:
+        if (! push (h, h->stack[X1]))
+            return 0;
+        break;
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+        if (! decode (h->stack[Y], &y) || ! decode (h->stack[X], &x))
+            return 0;
+        switch (op) {
+        case OP_SUB:
+            x.neg = ! x.neg;
+            /* fall through */
+        case OP_ADD:
+            if (! add (v, &y, &x))
+                return 0;
+            break;
+        case OP_MUL:
+            if (! mul (v, &y, &x))
+                return 0;
+            break;
+        default:
+            if (! divide (v, &y, &x))
+                return 0;
+            break;
+        }
+        result_xy (h, v);
+        break;
+
+    case OP_XY:
+        memcpy (v, h->stack[Y], 6);
+        memcpy (h->stack[Y], h->stack[X], 6);
+        result_x (h, v);
+        break;
+
+    case OP_PI:
+        memcpy (h->stack[X1], h->stack[X], 6);
+        push (h, value_pi);
+        break;
+
+    case OP_EXP10:
+    case OP_EXP:
+    case OP_LG:
+    case OP_LN:
+    case OP_ASIN:
+    case OP_ACOS:
+    case OP_SIN:
+    case OP_COS:
+    case OP_TAN:
+    case OP_SQRT:
+        if (! hle_exact_function (op, h->stack[X], h->rgd, v))
+            return 0;
+        result_x (h, v);
+        break;
+
+    case OP_SQUARE:
+        if (! decode (h->stack[X], &x) || ! mul (v, &x, &x))
+            return 0;
+        result_x (h, v);
+        break;
+
+    case OP_RECIP:
+        y.neg = 0;
+        y.exp = 0;
+        y.mant = power10[7];
+        if (! decode (h->stack[X], &x) || ! divide (v, &y, &x))
+            return 0;
+        result_x (h, v);
+        break;
+
+    case OP_ROT:
+        memcpy (v, h->stack[X], 6);
+        memcpy (h->stack[X1], h->stack[X], 6);
+        memcpy (h->stack[X], h->stack[Y], 6);
+        memcpy (h->stack[Y], h->stack[Z], 6);
+        memcpy (h->stack[Z], h->stack[T], 6);
+        memcpy (h->stack[T], v, 6);
+        break;
+
+    case OP_ABS:
+        if (! decode (h->stack[X], &x) || x.mant < power10[7])
+            return 0;
+        memcpy (v, h->stack[X], 6);
+        v[1] &= 0x0f;
+        result_x (h, v);
+        break;
+
+    case OP_SIGN:
+        if (! decode (h->stack[X], &x) || (x.mant != 0 && x.mant < power10[7]))
+            return 0;
+        encode (v, x.neg, x.mant != 0, 0);
+        result_x (h, v);
+        break;
+
+    case OP_INT:
+    case OP_FRAC:
+        if (! decode (h->stack[X], &x) || (x.mant != 0 && x.mant < power10[7]))
+            return 0;
+        if (x.exp < 0)
+            k = (op == OP_INT) ? 0 : x.mant;
+        else if (x.exp >= 7)
+            k = (op == OP_INT) ? x.mant : 0;
+        else if (op == OP_INT)
+            k = x.mant - x.mant % power10[7 - x.exp];
+        else
+            k = x.mant % power10[7 - x.exp];
+        // Zero with a sign is visible to some instructions,
+        // but not in the stack.
+        if (k == 0 && x.neg)
+            return 0;
+        encode (v, x.neg, k, x.exp - 7);
+        result_x (h, v);
+        break;
+
+    case OP_STOPGO:
+        break;
+
+    case OP_GOTO:
+        if (! jump_address (h, &next))
+            return 0;
+        break;
+
+    case OP_RET:
+        next = pop_return (h) + 1;
+        break;
+
+    case OP_CALL:
+        if (! jump_address (h, &next) || ! push_return (h, h->pc + 1))
+            return 0;
+        break;
+
+    case OP_NOP:
+        break;
+
+    case OP_IFNZ:
+    case OP_IFGE:
+    case OP_IFLT:
+    case OP_IFZ:
+        cond = condition (h, op);
+        if (cond < 0 || ! jump_address (h, &addr))
+            return 0;
+        next = cond ? h->pc + 2 : addr;
+        break;
+
+    case OP_LOOP0:
+    case OP_LOOP1:
+    case OP_LOOP2:
+    case OP_LOOP3:
+        i = (op == OP_LOOP0) ? 0 : (op == OP_LOOP1) ? 1 :
+            (op == OP_LOOP2) ? 2 : 3;
+        if (! jump_address (h, &addr) || ! decode (h->regs[i], &x) ||
+            x.neg || x.exp < 0 || x.exp > 7)
+            return 0;
+        k = x.mant / power10 [7 - x.exp];
+        if (k == 1) {
+            next = h->pc + 2;
+            break;
+        }
+        if (k == 0)
+            return 0;
+        encode_int (h->regs[i], k - 1);
+        next = addr;
+        break;
+
+    default:
+        i = op & 15;
+        switch (op >> 4) {
+        case 0x4:                       // П n
+            if (i >= DATA_NREGS)
+                return 0;
+            memcpy (h->regs[i], h->stack[X], 6);
+            break;
+
+        case 0x6:                       // ИП n
+            if (i >= DATA_NREGS || ! push (h, h->regs[i]))
+                return 0;
+            break;
+
+        case 0x7:                       // K x!=0 n
+        case 0x9:                       // K x>=0 n
+        case 0xc:                       // K x<0 n
+        case 0xe:                       // K x=0 n
+            cond = condition (h, (op >> 4 == 0x7) ? OP_IFNZ :
+                (op >> 4 == 0x9) ? OP_IFGE : (op >> 4 == 0xc) ? OP_IFLT : OP_IFZ);
+            if (cond < 0)
+                return 0;
+            if (cond)
+                break;
+
+            // Register is modified only when the jump is taken.
+            if (! indirect (h, i, &k, v) || k >= 100)
+                return 0;
+            memcpy (h->regs[i], v, 6);
+            next = k;
+            break;
+
+        case 0x8:                       // K БП n
+            if (! indirect (h, i, &k, v) || k >= 100)
+                return 0;
+            memcpy (h->regs[i], v, 6);
+            next = k;
+            break;
+
+        case 0xa:                       // K ПП n
+            if (! indirect (h, i, &k, v) || k >= 100 ||
+                ! push_return (h, h->pc))
+                return 0;
+            memcpy (h->regs[i], v, 6);
+            next = k;
+            break;
+
+        case 0xb:                       // K П n
+            if (! indirect (h, i, &k, v) || k >= DATA_NREGS)
+                return 0;
+            memcpy (h->regs[i], v, 6);
+            memcpy (h->regs[k], h->stack[X], 6);
+            break;
+
+        case 0xd:                       // K ИП n
+            if (! indirect (h, i, &k, v) || k >= DATA_NREGS ||
+                ! decode ((k == i) ? v : h->regs[k], &x))
+                return 0;
+            memcpy (h->regs[i], v, 6);
+            push (h, h->regs[k]);
+            break;
+
+        default:
+            return 0;
+        }
+    }
+    h->pc = next;
+    h->entry = 0;
+    h->nolift = nolift;
+    return 1;
+}
+
+//
+// Set up the engine.
+//
+void hle_init (hle_t *h, const unsigned char code[])
+{
+    memset (h, 0, sizeof(*h));
+    memcpy (h->code, code, CODE_NBYTES);
+    h->rgd = MODE_DEGREES;
+}
+
+//
+// Execute at most a given number of instructions.
+//
+int hle_run (hle_t *h, unsigned long long limit)
+{
+    unsigned op;
+
+    for (; limit > 0; limit--) {
+        if (h->pc >= CODE_NBYTES)
+            return HLE_UNSUPPORTED;
+        op = h->code [h->pc];
+        if (op <= OP_POINT) {
+            if (! enter (h, op))
+                return HLE_UNSUPPORTED;
+        } else if (! execute (h, op))
+            return HLE_UNSUPPORTED;
+        h->count++;
+        if (op == OP_STOPGO)
+            return HLE_STOPPED;
+    }
+    return HLE_LIMIT;
+}
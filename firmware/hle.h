@@ -0,0 +1,88 @@
+/*
+ * Fast simulator of MK-61 programs at the level of instructions.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+//
+// Instructions of the user program are executed directly, without
+// the microcode.  Results must be bit-exact with the microcode, so
+// only well understood cases are simulated: arithmetic is done
+// when the microcode result is exact, and digit entry, stack,
+// registers and control flow are done as on the real calculator.
+// For any other instruction or operand, hle_run() stops before
+// the instruction with HLE_UNSUPPORTED status, and the caller
+// should continue with the microcode simulation.
+//
+// Values are stored in the format of calc_get_stack(): 6 bytes,
+// nibble 0 - sign of exponent, 1-2 - exponent, 3 - sign,
+// 4-11 - mantissa, most significant digit first.
+//
+#define HLE_NRETURN     5               // Depth of return stack
+
+//
+// Status of hle_run().
+//
+#define HLE_STOPPED     1               // С/П executed
+#define HLE_UNSUPPORTED 2               // Instruction needs the microcode
+#define HLE_LIMIT       3               // Instruction limit exceeded
+
+typedef struct {
+    unsigned char code [CODE_NBYTES];   // Program code
+    unsigned char stack [5][6];         // X1, X, Y, Z, T
+    unsigned char regs [DATA_NREGS][6]; // Registers 0-9, a-e
+    unsigned pc;                        // Address of next instruction
+    unsigned char rstack [HLE_NRETURN]; // Return addresses, minus 1
+    int nreturn;                        // Depth of return stack
+    unsigned long long count;           // Number of executed instructions
+    int rgd;                            // Radians/grads/degrees switch
+
+    // Digit entry.
+    int entry;                          // Digits are being entered
+    int nolift;                         // Next digit replaces X
+    unsigned long entry_mant;           // Digits entered
+    int entry_ndigits;                  // Number of digits entered
+    int entry_frac;                     // Digits after point, or -1
+} hle_t;
+
+//
+// Set up the engine: program code, empty stack and registers,
+// address 0, degrees mode.
+//
+void hle_init (hle_t *h, const unsigned char code[]);
+
+//
+// Execute at most a given number of instructions.
+// Return HLE_STOPPED, HLE_UNSUPPORTED or HLE_LIMIT.
+//
+int hle_run (hle_t *h, unsigned long long limit);
+
+//
+// Compute a function of X, where the result of the microcode
+// is known exactly: square root (0x21), and special arguments
+// of 10^x, e^x, lg, ln, sin, cos, tg, arcsin and arccos, like
+// 10^n, lg of 10^n for |n| <= 3, e^0, ln 1, sin and cos at 0
+// and at the right angle, with angles in MODE_* units.
+// Return 0 for other arguments and functions: they are left
+// to the microcode.
+//
+int hle_exact_function (unsigned op, const unsigned char x[6], int rgd,
+    unsigned char result[6]);
@@ -0,0 +1,285 @@
+/*
+ * Hybrid of the microcode simulation and the instruction-level engine.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "calc.h"
+#include "hle.h"
+#include "hybrid.h"
+
+//
+// Effect of an instruction on the working register of the microcode.
+// After ИП n and Вx, X is written to the memory, and also kept
+// in ST register of ИК1302, in the form prepared for the display:
+// the engine can take the state.  Other instructions keep X
+// in other places, and write it to the memory later.
+//
+#define INSN_DIRTY      0               // State is not known
+#define INSN_RESULT     1               // X is in the working register
+#define INSN_KEEP       2               // X is not changed
+
+static int insn_effect (unsigned op)
+{
+    switch (op >> 4) {
+    case 0x0:                           // Вx
+        return (op == 0x0f) ? INSN_RESULT : INSN_DIRTY;
+    case 0x4:                           // П n
+        return INSN_KEEP;
+    case 0x5:
+        return (op == 0x50 || op == 0x55 || op == 0x56 || op > 0x5e) ?
+            INSN_DIRTY : INSN_KEEP;
+    case 0x6:                           // ИП n
+    case 0xd:                           // K ИП n
+        return (op & 15) < DATA_NREGS ? INSN_RESULT : INSN_DIRTY;
+    case 0x7:                           // Indirect jumps and stores
+    case 0x8:
+    case 0x9:
+    case 0xa:
+    case 0xb:
+    case 0xc:
+    case 0xe:
+        return (op & 15) < DATA_NREGS ? INSN_KEEP : INSN_DIRTY;
+    }
+    return INSN_DIRTY;
+}
+
+//
+// Set an address as two digits in R register.
+//
+static void set_address (calc_t *c, int tens, int units, unsigned addr)
+{
+    c->ik1302.R[tens] = addr / 10;
+    c->ik1302.R[units] = addr % 10;
+}
+
+//
+// Copy the state of the calculator to the engine.
+// Depth of the return stack is not stored by the microcode:
+// it is computed as the number of used entries.
+//
+static void load_engine (hle_t *e, calc_t *c, unsigned pc)
+{
+    unsigned rstack [CALC_NRETURN];
+    int i;
+
+    // Program is read every time: with invalid values in registers,
+    // the microcode can overwrite it.
+    calc_get_code (c, e->code);
+    calc_get_stack (c, e->stack);
+    calc_get_regs (c, e->regs);
+    calc_get_rstack (c, rstack);
+    e->pc = pc;
+    e->nreturn = 0;
+    for (i=0; i<HLE_NRETURN; i++) {
+        e->rstack[i] = rstack[i];
+        if (e->rstack[i] != 0)
+            e->nreturn = i + 1;
+    }
+    e->rgd = c->ik1303.keyb_x;
+    e->entry = 0;
+    e->nolift = 0;
+}
+
+//
+// Get a nibble of the value: 0-2 exponent, 3 sign, 4-11 mantissa.
+//
+static inline unsigned nibble (const unsigned char v[6], int i)
+{
+    return (i & 1) ? (v[i/2] >> 4) : (v[i/2] & 15);
+}
+
+//
+// Put X to the working register: ST of ИК1302 holds the digits
+// of mantissa, least significant first, with the position
+// of the decimal point, the sign, the exponent as shown on the display
+// (digit 15 is blank, 10 is minus), and the exponent as stored.
+// Values with exponent 0...7 are shown without the exponent.
+//
+// This is the form which ИП n leaves for most values, but not
+// an inverse: the form depends on the history, and these variants
+// are not rebuilt:
+// - after digit entry, nibbles 3*i+2 of typed digits are 10, not 8;
+// - ИП n sometimes leaves the digits shifted, without the marks
+//   of the point in nibbles 3*i+1, and with other exponent digits;
+// - nibble 35 is sometimes left as 15.
+// Digit entry and ВП read the form.  The engine does not hand over
+// before ВП, and random programs of hletest -y give the same results
+// as the microcode alone.
+//
+static void store_working (calc_t *c, const unsigned char x[6])
+{
+    unsigned char *st = c->ik1302.ST;
+    int exp, fixed, i;
+
+    exp = nibble (x, 1) * 10 + nibble (x, 2);
+    if (nibble (x, 0) != 0)
+        exp -= 100;
+    fixed = (exp >= 0 && exp <= 7);
+    for (i=0; i<8; i++) {
+        st[3*i] = nibble (x, 11 - i);
+        st[3*i+1] = fixed ? 8 + exp : 8;
+        st[3*i+2] = (i == 0) ? 0 : 8;
+    }
+    st[22] = 0;
+    st[23] = 15;
+    st[24] = nibble (x, 3);
+    st[25] = 0;
+    st[26] = 0;
+    st[27] = fixed ? 15 : abs (exp) % 10;
+    st[28] = nibble (x, 2);
+    st[29] = 0;
+    st[30] = fixed ? 15 : abs (exp) / 10;
+    st[31] = nibble (x, 1);
+    st[32] = 0;
+    st[33] = (! fixed && exp < 0) ? 10 : 15;
+    st[34] = nibble (x, 0);
+    st[35] = 0;
+}
+
+//
+// Copy the state of the engine back to the calculator.
+//
+static void store_engine (hle_t *e, calc_t *c)
+{
+    int i;
+
+    calc_set_stack (c, e->stack);
+    calc_set_regs (c, e->regs);
+    store_working (c, e->stack[1]);
+    set_address (c, PC_TENS, PC_UNITS, e->pc);
+    c->ik1302.R[PC_WORD] = e->pc / 7;
+    c->ik1302.R[PC_INDEX] = e->pc % 7;
+    c->ik1302.R[OPCODE_HIGH] = e->code[e->pc] >> 4;
+    c->ik1302.R[OPCODE_LOW] = e->code[e->pc] & 15;
+    for (i=0; i<HLE_NRETURN; i++)
+        set_address (c, RSTACK_TENS(i), RSTACK_UNITS(i), e->rstack[i]);
+
+    // The opcode is taken as fetched by calc_run(): the address byte
+    // of a jump comes next.
+    c->fetch_jump = INSN_FETCHES_TWICE (e->code[e->pc]);
+}
+
+//
+// Run instructions on the engine, until an instruction is not
+// supported, or С/П is reached, or the limit is exceeded.
+// The state is written back to the calculator at the last
+// instruction, where the microcode can continue: X is in the state
+// as after ИП n or Вx, the digit entry is finished, the program
+// counter is in range, and the next instruction is not ВП,
+// which needs the display register.
+// Return the number of executed instructions.
+//
+static unsigned long long run_engine (hybrid_t *h, calc_t *c, unsigned pc,
+    unsigned long long limit)
+{
+    hle_t *e = &h->hle;
+    unsigned long long count = 0, saved_count = 0;
+    unsigned op;
+    int clean = 1;
+
+    load_engine (e, c, pc);
+    h->saved = *e;
+    while (count < limit && e->pc < CODE_NBYTES) {
+        op = e->code [e->pc];
+        if (op == 0x50)                 // С/П
+            break;
+        if (clean && op != 0x0c && ! e->entry && ! e->nolift) {
+            h->saved = *e;
+            saved_count = count;
+        }
+        if (hle_run (e, 1) != HLE_LIMIT)
+            break;
+        count++;
+        switch (insn_effect (op)) {
+        case INSN_DIRTY:  clean = 0; break;
+        case INSN_RESULT: clean = 1; break;
+        }
+    }
+    if (! clean || e->pc >= CODE_NBYTES || e->entry || e->nolift ||
+        e->code[e->pc] == 0x0c) {
+        *e = h->saved;
+        count = saved_count;
+    }
+    if (count > 0) {
+        store_engine (e, c);
+        h->native += count;
+        h->switches++;
+    }
+    return count;
+}
+
+//
+// Clear the counters.
+//
+void hybrid_init (hybrid_t *h)
+{
+    memset (h, 0, sizeof(*h));
+}
+
+//
+// Run the user program until it stops.
+//
+int hybrid_run (hybrid_t *h, calc_t *c, unsigned long long limit)
+{
+    unsigned long long count = 0;
+    unsigned op;
+    int clean = 1;
+    calc_run_t r;
+
+    // Press С/П and stop at the fetch of the first instruction:
+    // the key has finished the digit entry, so the engine can start.
+    r.keycode = KEY_STOPGO;
+    r.max_words = ~0ul;
+    r.max_insns = 1;
+    r.stable_words = 0;
+    for (;;) {
+        if (calc_run (c, &r) != CALC_INSNS) {
+            // Program stopped: finish the step.
+            h->words += r.words;
+            while (c->word != 0) {
+                calc_step_word (c);
+                h->words++;
+            }
+            return 0;
+        }
+        h->words += r.words;
+        r.keycode = 0;
+        if (count >= limit)
+            return 1;
+
+        // Microcode is at the fetch of the next instruction.
+        if (clean) {
+            count += run_engine (h, c, calc_get_pc (c), limit - count);
+            if (count >= limit)
+                return 1;
+        }
+        op = c->ik1302.R[OPCODE_HIGH] << 4 | c->ik1302.R[OPCODE_LOW];
+        switch (insn_effect (op)) {
+        case INSN_DIRTY:  clean = 0; break;
+        case INSN_RESULT: clean = 1; break;
+        }
+        count++;
+        h->simulated++;
+    }
+}
@@ -0,0 +1,61 @@
+/*
+ * Hybrid of the microcode simulation and the instruction-level engine.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+//
+// User program runs on the instruction-level engine from the start,
+// and falls back to the microcode simulation for instructions which
+// the engine does not support.  The engine state is written back
+// to the serial registers, and the microcode executes the instruction.
+// When the microcode reaches the fetch of the next user instruction
+// with a clean state (no digit entry in progress, no hidden values
+// in the working register), the engine takes over again.
+//
+// Instructions with digit entry are never handed over in the middle:
+// the engine rolls back to the state before the number, and the
+// microcode enters it again.  С/П is always executed by the microcode,
+// so the stopped calculator is exactly as after calc_step().
+//
+typedef struct {
+    hle_t hle;                          // Instruction-level engine
+    hle_t saved;                        // Engine state before digit entry
+    unsigned long long native;          // Instructions run by the engine
+    unsigned long long simulated;       // Instructions run by the microcode
+    unsigned long long words;           // Words simulated
+    unsigned long long switches;        // Transfers to the engine
+} hybrid_t;
+
+//
+// Clear the counters.
+//
+void hybrid_init (hybrid_t *h);
+
+//
+// Start the user program by С/П on the stopped calculator, and run
+// it until it stops.  Keys must be released.  At most a given number
+// of instructions is executed.  Return 0 when the program stopped:
+// the calculator is left at the end of calc_step().  Return 1 when
+// the limit is exceeded: the calculator is left before the next
+// instruction.
+//
+int hybrid_run (hybrid_t *h, calc_t *c, unsigned long long limit);
@@ -24,30 +24,85 @@
  */
 #include "calc.h"
 
+//
+// Get the micro-instruction address for a given command and cycle,
+// before the carry correction.
+//
+static unsigned plm_fetch (const unsigned char *prog_rom,
+    unsigned command, unsigned cycle)
+{
+    static const unsigned char remap[42] = {
+        0,1,2,  3,4,5,  3,4,5,  3,4,5,  3,4,5,  3,4,5,  3,4,5,
+        3,4,5,  6,7,8,  0,1,2,  3,4,5,  6,7,8,  0,1,2,  3,4,5,
+    };
+
+    /*
+     * Use PC to get the program index.
+     */
+    unsigned prog_index;
+    if (cycle < 27)
+        prog_index = command & 0xff;
+    else if (cycle < 36)
+        prog_index = (command >> 8) & 0xff;
+    else {
+        prog_index = (command >> 16) & 0xff;
+        if (prog_index > 0x1f)
+            prog_index = 0x5f;
+    }
+    return prog_rom[prog_index*9 + remap[cycle]] & 0x3f;
+}
+
+#ifdef PLM_TRACE_CACHE
+//
+// Get a sequence of micro-instruction addresses for the command.
+// Compute it on first use.  Addresses 60 and above depend on carry:
+// they are stored doubled, with flag TRACE_NCARRY.
+// The cache can be shared between threads: every trace
+// is computed by one of them.
+//
+const unsigned char *plm_trace (plm_rom_t *rom, unsigned pc)
+{
+    unsigned char *trace = rom->trace[pc];
+    unsigned cycle;
+
+    if (lazy_start (&rom->traced[pc])) {
+        unsigned command = rom->cmd_rom[pc];
+
+        for (cycle=0; cycle<REG_NWORDS; cycle++) {
+            unsigned inst_addr = plm_fetch (rom->prog_rom, command, cycle);
+            if (inst_addr >= 60)
+                inst_addr = (inst_addr + inst_addr - 60) | TRACE_NCARRY;
+            trace[cycle] = inst_addr;
+        }
+        lazy_done (&rom->traced[pc]);
+    }
+    return trace;
+}
+#endif
+
 //
 // Initialize the PLM data structure.
 //
-void plm_init (plm_t *t, const unsigned inst_rom[],
-    const unsigned cmd_rom[], const unsigned char prog_rom[])
+void plm_init (plm_t *t, plm_rom_t *rom)
 {
     int i;
 
-    t->inst_rom = inst_rom;
-    t->cmd_rom = cmd_rom;
-    t->prog_rom = prog_rom;
+    t->ucmd = rom->ucmd;
+    t->cmd_rom = rom->cmd_rom;
+    t->prog_rom = rom->prog_rom;
+#ifdef PLM_TRACE_CACHE
+    t->rom = rom;
+    t->trace = plm_trace (rom, 0);
+#endif
 
     for (i=0; i<REG_NWORDS; i++) {
         t->R[i] = 0;
-        t->M[i] = 0;
         t->ST[i] = 0;
     }
-    t->input = 0;
-    t->output = 0;
     t->S = 0;
     t->Q = 0;
     t->carry = 0;
     t->keypad_event = 0;
-    t->opcode = 0;
     t->keyb_x = 0;
     t->keyb_y = 0;
     t->dot = 0;
@@ -56,16 +111,33 @@ void plm_init (plm_t *t, const unsigned inst_rom[],
     for (i=0; i<14; i++) {
         t->show_dot[i] = 0;
     }
+#ifdef PLM_PROFILE
+    for (i=0; i<PLM_NCMDS; i++)
+        t->cmd_count[i] = 0;
+    for (i=0; i<PLM_NUCMDS; i++)
+        t->ucmd_count[i] = 0;
+#endif
 }
 
 //
 // Simulate one cycle of the PLM chip.
+// Inlined with a constant cycle number, all the index arithmetic
+// is computed at compile time.  Return nonzero when M has changed.
 //
-void plm_step (plm_t *t, unsigned cycle)
+static inline __attribute__((always_inline))
+unsigned plm_cycle (plm_t *t, unsigned char M[], unsigned cycle)
 {
     /* D stage in range 0...13 */
     unsigned d = cycle / 3;
 
+    /* Keep registers in local variables: stores to R, M and ST arrays
+     * would otherwise force reloading them. */
+    unsigned S = t->S;
+    unsigned Q = t->Q;
+    unsigned carry = t->carry;
+    unsigned keypad_event = t->keypad_event;
+    unsigned changed = 0;
+
     /*
      * Fetch program counter from the R register.
      */
@@ -74,25 +146,23 @@ void plm_step (plm_t *t, unsigned cycle)
 
         t->command = t->cmd_rom[pc];
         if ((t->command & 0xfc0000) == 0)
-            t->keypad_event = 0;
+            keypad_event = 0;
+#ifdef PLM_TRACE_CACHE
+        t->trace = plm_trace (t->rom, pc);
+#endif
+#ifdef PLM_PROFILE
+        t->cmd_count[pc]++;
+#endif
     }
 
     /*
-     * Use PC to get the program index.
+     * Extended address of the command is loaded into R register.
      */
-    unsigned prog_index;
-    if (cycle < 27)
-        prog_index = t->command & 0xff;
-    else if (cycle < 36)
-        prog_index = (t->command >> 8) & 0xff;
-    else {
-        prog_index = (t->command >> 16) & 0xff;
+    if (cycle == 36) {
+        unsigned prog_index = (t->command >> 16) & 0xff;
         if (prog_index > 0x1f) {
-            if (cycle == 36) {
-                t->R[37] = prog_index & 0xf;
-                t->R[40] = prog_index >> 4;
-            }
-            prog_index = 0x5f;
+            t->R[37] = prog_index & 0xf;
+            t->R[40] = prog_index >> 4;
         }
     }
     unsigned modifier = (t->command >> 24) & 0xff;
@@ -100,74 +170,76 @@ void plm_step (plm_t *t, unsigned cycle)
     /*
      * Fetch the instruction opcode.
      */
-    const unsigned char remap[42] = {
-        0,1,2,  3,4,5,  3,4,5,  3,4,5,  3,4,5,  3,4,5,  3,4,5,
-        3,4,5,  6,7,8,  0,1,2,  3,4,5,  6,7,8,  0,1,2,  3,4,5,
-    };
-    unsigned inst_addr = t->prog_rom[prog_index*9 + remap[cycle]] & 0x3f;
+#ifdef PLM_TRACE_CACHE
+    unsigned inst_addr = t->trace[cycle];
+    inst_addr = (inst_addr & ~TRACE_NCARRY) +
+                ((inst_addr >> 7) & (carry ^ 1));
+#else
+    unsigned inst_addr = plm_fetch (t->prog_rom, t->command, cycle);
     if (inst_addr >= 60) {
         inst_addr += inst_addr - 60;
-        if (! t->carry)
+        if (! carry)
             inst_addr++;
     }
-    t->opcode = t->inst_rom[inst_addr];
+#endif
+#ifdef PLM_PROFILE
+    t->ucmd_count[inst_addr]++;
+#endif
+    const plm_ucmd_t *u = &t->ucmd[inst_addr];
+    unsigned op = u->op;
 
     /*
      * Execute the opcode.
      */
-    unsigned alpha = 0, beta = 0, gamma = 0;
-    if (t->opcode & UCMD_KEYPAD) {
+    if (op & UCMD_OP(UCMD_KEYPAD)) {
         if (d != (t->keyb_x - 1) && t->keyb_y > 0)
-            t->Q = t->keyb_y;
+            Q = t->keyb_y;
     }
 
-    /* Alpha. */
-    if (t->opcode & UCMD_ALPHA_R)   alpha |= t->R[cycle];
-    if (t->opcode & UCMD_ALPHA_M)   alpha |= t->M[cycle];
-    if (t->opcode & UCMD_ALPHA_ST)  alpha |= t->ST[cycle];
-    if (t->opcode & UCMD_ALPHA_NR)  alpha |= t->R[cycle] ^ 0xf;
-    if (t->opcode & UCMD_ALPHA_C10
-        && ! t->carry)              alpha |= 0xa;
-    if (t->opcode & UCMD_ALPHA_S)   alpha |= t->S;
-    if (t->opcode & UCMD_ALPHA_4)   alpha |= 4;
-
-    /* Beta. */
-    if (t->opcode & UCMD_BETA_S)    beta |= t->S;
-    if (t->opcode & UCMD_BETA_NS)   beta |= t->S ^ 0xf;
-    if (t->opcode & UCMD_BETA_Q)    beta |= t->Q;
-    if (t->opcode & UCMD_BETA_6)    beta |= 6;
-    if (t->opcode & UCMD_BETA_1)    beta |= 1;
+    /* Alpha and beta: all sources are masked, no branches. */
+    unsigned r = t->R[cycle];
+    unsigned alpha = (r & u->alpha) |
+                     (M[cycle] & u->alpha >> 4) |
+                     (t->ST[cycle] & u->alpha >> 8) |
+                     ((r ^ 0xf) & u->alpha >> 12) |
+                     (S & u->alpha >> 16) |
+                     ((u->alpha >> 20) & 0xf) |
+                     ((u->alpha >> 24) & (carry - 1));
+    unsigned beta = (S & u->beta) |
+                    ((S ^ 0xf) & u->beta >> 4) |
+                    (Q & u->beta >> 8) |
+                    (u->beta >> 12);
 
     /*
      * Poll keypad.
      */
     if (t->command & 0xfc0000) {
         if (t->keyb_y == 0)
-            t->keypad_event = 0;
+            keypad_event = 0;
     } else {
         t->enable_display = 1;
         if (d == (t->keyb_x - 1)) {
             if (t->keyb_y > 0) {
-                t->Q = t->keyb_y;
-                t->keypad_event = 1;
+                Q = t->keyb_y;
+                keypad_event = 1;
             }
         }
-        if (t->carry && d < 12)
+        if (carry && d < 12)
             t->dot = d;
-        t->show_dot[d] = t->carry;
+        t->show_dot[d] = carry;
     }
 
-    /* Gamma. */
-    if (t->opcode & UCMD_GAMMA_CARRY)   gamma |= t->carry;
-    if (t->opcode & UCMD_GAMMA_NCARRY)  gamma |= t->carry ^ 1;
-    if (t->opcode & UCMD_GAMMA_NKEY)    gamma |= t->keypad_event ^ 1;
+    /* Gamma: bits 0-2 of op select carry, ~carry and ~keypad_event. */
+    unsigned gamma = (carry & op) |
+                     ((carry ^ 1) & op >> 1) |
+                     ((keypad_event ^ 1) & op >> 2);
 
     /*
      * Compute sum and carry.
      */
     unsigned sum = alpha + beta + gamma;
-    if (t->opcode & UCMD_CARRY_SUM)
-        t->carry = (sum >> 4) & 1;
+    if (op & UCMD_OP(UCMD_CARRY_SUM))
+        carry = (sum >> 4) & 1;
     sum &= 0xf;
 
     if (modifier == 0 || cycle >= 36) {
@@ -184,39 +256,41 @@ void plm_step (plm_t *t, unsigned cycle)
         if (cycle_minus_2 >= REG_NWORDS)
             cycle_minus_2 -= REG_NWORDS;
 
-        switch (t->opcode & UCMD_R_MASK) {
-        case UCMD_R_R3:     t->R[cycle]  = t->R[cycle_plus_3];  break;
-        case UCMD_R_SUM:    t->R[cycle]  = sum;                 break;
-        case UCMD_R_S:      t->R[cycle]  = t->S;                break;
-        case UCMD_R_RSSUM:  t->R[cycle] |= t->S | sum;          break;
-        case UCMD_R_SSUM:   t->R[cycle]  = t->S | sum;          break;
-        case UCMD_R_RS:     t->R[cycle] |= t->S;                break;
-        case UCMD_R_RSUM:   t->R[cycle] |= sum;                 break;
+        switch (op & UCMD_OP(UCMD_R_MASK)) {
+        case UCMD_OP(UCMD_R_R3):    t->R[cycle]  = t->R[cycle_plus_3];  break;
+        case UCMD_OP(UCMD_R_SUM):   t->R[cycle]  = sum;                 break;
+        case UCMD_OP(UCMD_R_S):     t->R[cycle]  = S;                   break;
+        case UCMD_OP(UCMD_R_RSSUM): t->R[cycle] |= S | sum;             break;
+        case UCMD_OP(UCMD_R_SSUM):  t->R[cycle]  = S | sum;             break;
+        case UCMD_OP(UCMD_R_RS):    t->R[cycle] |= S;                   break;
+        case UCMD_OP(UCMD_R_RSUM):  t->R[cycle] |= sum;                 break;
         }
-        if (t->opcode & UCMD_R1_SUM) t->R[cycle_minus_1] = sum;
-        if (t->opcode & UCMD_R2_SUM) t->R[cycle_minus_2] = sum;
+        if (op & UCMD_OP(UCMD_R1_SUM)) t->R[cycle_minus_1] = sum;
+        if (op & UCMD_OP(UCMD_R2_SUM)) t->R[cycle_minus_2] = sum;
     }
 
     /*
      * Update M register.
      */
-    if (t->opcode & UCMD_M_S)
-        t->M[cycle] = t->S;
+    if (op & UCMD_OP(UCMD_M_S)) {
+        changed = M[cycle] ^ S;
+        M[cycle] = S;
+    }
 
     /*
      * Update S register.
      */
-    switch (t->opcode & UCMD_S_MASK) {
-    case UCMD_S_Q:      t->S = t->Q;        break;
-    case UCMD_S_SUM:    t->S = sum;         break;
-    case UCMD_S_QSUM:   t->S = t->Q | sum;  break;
+    switch (op & UCMD_OP(UCMD_S_MASK)) {
+    case UCMD_OP(UCMD_S_Q):    S = Q;        break;
+    case UCMD_OP(UCMD_S_SUM):  S = sum;      break;
+    case UCMD_OP(UCMD_S_QSUM): S = Q | sum;  break;
     }
 
     /*
      * Update Q register.
      */
-    if (t->opcode & UCMD_Q_SUM)
-        t->Q = sum;
+    if (op & UCMD_OP(UCMD_Q_SUM))
+        Q = sum;
 
     /*
      * Update ST register.
@@ -228,21 +302,55 @@ void plm_step (plm_t *t, unsigned cycle)
     if (cycle_plus_2 >= REG_NWORDS)
         cycle_plus_2 -= REG_NWORDS;
 
-    if (t->opcode & UCMD_ST_SUM) {
+    if (op & UCMD_OP(UCMD_ST_SUM)) {
         t->ST[cycle_plus_2] = t->ST[cycle_plus_1];
         t->ST[cycle_plus_1] = t->ST[cycle];
         t->ST[cycle]        = sum;
     }
-    if (t->opcode & UCMD_ST_ROT) {
+    if (op & UCMD_OP(UCMD_ST_ROT)) {
         unsigned x = t->ST[cycle];
         t->ST[cycle]        = t->ST[cycle_plus_1];
         t->ST[cycle_plus_1] = t->ST[cycle_plus_2];
         t->ST[cycle_plus_2] = x;
     }
+    t->S = S;
+    t->Q = Q;
+    t->carry = carry;
+    t->keypad_event = keypad_event;
+    return changed;
+}
+
+//
+// Simulate one cycle of the PLM chip.
+// Register M is a word of the memory ring, owned by the calculator.
+//
+unsigned plm_step (plm_t *t, unsigned char M[], unsigned cycle)
+{
+    return plm_cycle (t, M, cycle);
+}
+
+//
+// Simulate a word (all 42 cycles) of the PLM chip.
+//
+unsigned plm_run_word (plm_t *t, unsigned char M[])
+{
+    unsigned i, changed;
 
     /*
-     * Store input, pass output.
+     * Cycles with wrap-around of R and ST indices, and cycles 0 and 36
+     * with command fetch, are expanded with constant numbers.
+     * In the loop between them, the compiler knows the index range
+     * and drops all wrap-around checks.
      */
-    t->output = t->M[cycle] & 0xf;
-    t->M[cycle] = t->input;
+    changed = plm_cycle (t, M, 0);
+    changed |= plm_cycle (t, M, 1);
+    for (i=2; i<36; i++)
+        changed |= plm_cycle (t, M, i);
+    changed |= plm_cycle (t, M, 36);
+    changed |= plm_cycle (t, M, 37);
+    changed |= plm_cycle (t, M, 38);
+    changed |= plm_cycle (t, M, 39);
+    changed |= plm_cycle (t, M, 40);
+    changed |= plm_cycle (t, M, 41);
+    return changed;
 }
@@ -3,24 +3,30 @@
  * Using data from emu145 project by Felix Lazarev:
  * https://code.google.com/p/emu145/
  */
-static const unsigned int ik1302_ucmd_rom[] = {
-    0x0000000, 0x0800001, 0x0A00820, 0x0040020,
-    0x0A03120, 0x0203081, 0x0A00181, 0x0803800,
-    0x0818001, 0x0800400, 0x0A00089, 0x0A03C20,
-    0x0800820, 0x0080020, 0x0800120, 0x1400020,
-    0x0800081, 0x0210801, 0x0040000, 0x0058001,
-    0x0808001, 0x0A03081, 0x0A01081, 0x0A01181,
-    0x0040090, 0x0800401, 0x0A00081, 0x0040001,
-    0x0800801, 0x1000000, 0x0800100, 0x1200801,
-    0x0013C01, 0x0800008, 0x0A00088, 0x0010200,
-    0x0800040, 0x0800280, 0x1801200, 0x1000208,
-    0x0080001, 0x0A00082, 0x0A01008, 0x1000001,
-    0x0A00808, 0x0900001, 0x8010004, 0x0080820,
-    0x0800002, 0x0140002, 0x0008000, 0x0A00090,
-    0x0A00220, 0x0801001, 0x1203200, 0x4800001,
-    0x0011801, 0x1008001, 0x0A04020, 0x4800801,
-    0x0840801, 0x0840020, 0x0013081, 0x0010801,
-    0x0818180, 0x0800180, 0x0A00081, 0x0800001,
+static const plm_ucmd_t ik1302_ucmd_rom[] = {
+    PLM_UCMD (0x0000000), PLM_UCMD (0x0800001), PLM_UCMD (0x0A00820),
+    PLM_UCMD (0x0040020), PLM_UCMD (0x0A03120), PLM_UCMD (0x0203081),
+    PLM_UCMD (0x0A00181), PLM_UCMD (0x0803800), PLM_UCMD (0x0818001),
+    PLM_UCMD (0x0800400), PLM_UCMD (0x0A00089), PLM_UCMD (0x0A03C20),
+    PLM_UCMD (0x0800820), PLM_UCMD (0x0080020), PLM_UCMD (0x0800120),
+    PLM_UCMD (0x1400020), PLM_UCMD (0x0800081), PLM_UCMD (0x0210801),
+    PLM_UCMD (0x0040000), PLM_UCMD (0x0058001), PLM_UCMD (0x0808001),
+    PLM_UCMD (0x0A03081), PLM_UCMD (0x0A01081), PLM_UCMD (0x0A01181),
+    PLM_UCMD (0x0040090), PLM_UCMD (0x0800401), PLM_UCMD (0x0A00081),
+    PLM_UCMD (0x0040001), PLM_UCMD (0x0800801), PLM_UCMD (0x1000000),
+    PLM_UCMD (0x0800100), PLM_UCMD (0x1200801), PLM_UCMD (0x0013C01),
+    PLM_UCMD (0x0800008), PLM_UCMD (0x0A00088), PLM_UCMD (0x0010200),
+    PLM_UCMD (0x0800040), PLM_UCMD (0x0800280), PLM_UCMD (0x1801200),
+    PLM_UCMD (0x1000208), PLM_UCMD (0x0080001), PLM_UCMD (0x0A00082),
+    PLM_UCMD (0x0A01008), PLM_UCMD (0x1000001), PLM_UCMD (0x0A00808),
+    PLM_UCMD (0x0900001), PLM_UCMD (0x8010004), PLM_UCMD (0x0080820),
+    PLM_UCMD (0x0800002), PLM_UCMD (0x0140002), PLM_UCMD (0x0008000),
+    PLM_UCMD (0x0A00090), PLM_UCMD (0x0A00220), PLM_UCMD (0x0801001),
+    PLM_UCMD (0x1203200), PLM_UCMD (0x4800001), PLM_UCMD (0x0011801),
+    PLM_UCMD (0x1008001), PLM_UCMD (0x0A04020), PLM_UCMD (0x4800801),
+    PLM_UCMD (0x0840801), PLM_UCMD (0x0840020), PLM_UCMD (0x0013081),
+    PLM_UCMD (0x0010801), PLM_UCMD (0x0818180), PLM_UCMD (0x0800180),
+    PLM_UCMD (0x0A00081), PLM_UCMD (0x0800001),
 };
 
 static const unsigned int ik1302_cmd_rom[256] = {
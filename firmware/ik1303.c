@@ -3,24 +3,30 @@
  * Using data from emu145 project by Felix Lazarev:
  * https://code.google.com/p/emu145/
  */
-static const unsigned int ik1303_ucmd_rom[] = {
-    0x0000000, 0x0800001, 0x0040020, 0x1440090,
-    0x0A00081, 0x1000000, 0x1400020, 0x0800008,
-    0x0A03180, 0x1002200, 0x0800400, 0x1418001,
-    0x0080020, 0x0841020, 0x0203100, 0x0203088,
-    0x0A00820, 0x0800120, 0x08001C0, 0x0810081,
-    0x0A00089, 0x0800401, 0x0A010A0, 0x0A01081,
-    0x0818001, 0x1A00220, 0x0201100, 0x0203420,
-    0x0008000, 0x0801020, 0x0201420, 0x0801190,
-    0x0040000, 0x0080820, 0x0800002, 0x0140002,
-    0x0800100, 0x0A03C20, 0x0A00808, 0x0A01008,
-    0x0200540, 0x0601209, 0x0083100, 0x0A03081,
-    0x8800004, 0x0058001, 0x1001280, 0x1008001,
-    0x1200209, 0x4018001, 0x0040002, 0x1000001,
-    0x0010200, 0x0800840, 0x0A01181, 0x4018801,
-    0x0A10181, 0x0800801, 0x0040001, 0x0011190,
-    0x0858001, 0x0040020, 0x3200209, 0x08000C0,
-    0x4000020, 0x0600081, 0x1000000, 0x1000180,
+static const plm_ucmd_t ik1303_ucmd_rom[] = {
+    PLM_UCMD (0x0000000), PLM_UCMD (0x0800001), PLM_UCMD (0x0040020),
+    PLM_UCMD (0x1440090), PLM_UCMD (0x0A00081), PLM_UCMD (0x1000000),
+    PLM_UCMD (0x1400020), PLM_UCMD (0x0800008), PLM_UCMD (0x0A03180),
+    PLM_UCMD (0x1002200), PLM_UCMD (0x0800400), PLM_UCMD (0x1418001),
+    PLM_UCMD (0x0080020), PLM_UCMD (0x0841020), PLM_UCMD (0x0203100),
+    PLM_UCMD (0x0203088), PLM_UCMD (0x0A00820), PLM_UCMD (0x0800120),
+    PLM_UCMD (0x08001C0), PLM_UCMD (0x0810081), PLM_UCMD (0x0A00089),
+    PLM_UCMD (0x0800401), PLM_UCMD (0x0A010A0), PLM_UCMD (0x0A01081),
+    PLM_UCMD (0x0818001), PLM_UCMD (0x1A00220), PLM_UCMD (0x0201100),
+    PLM_UCMD (0x0203420), PLM_UCMD (0x0008000), PLM_UCMD (0x0801020),
+    PLM_UCMD (0x0201420), PLM_UCMD (0x0801190), PLM_UCMD (0x0040000),
+    PLM_UCMD (0x0080820), PLM_UCMD (0x0800002), PLM_UCMD (0x0140002),
+    PLM_UCMD (0x0800100), PLM_UCMD (0x0A03C20), PLM_UCMD (0x0A00808),
+    PLM_UCMD (0x0A01008), PLM_UCMD (0x0200540), PLM_UCMD (0x0601209),
+    PLM_UCMD (0x0083100), PLM_UCMD (0x0A03081), PLM_UCMD (0x8800004),
+    PLM_UCMD (0x0058001), PLM_UCMD (0x1001280), PLM_UCMD (0x1008001),
+    PLM_UCMD (0x1200209), PLM_UCMD (0x4018001), PLM_UCMD (0x0040002),
+    PLM_UCMD (0x1000001), PLM_UCMD (0x0010200), PLM_UCMD (0x0800840),
+    PLM_UCMD (0x0A01181), PLM_UCMD (0x4018801), PLM_UCMD (0x0A10181),
+    PLM_UCMD (0x0800801), PLM_UCMD (0x0040001), PLM_UCMD (0x0011190),
+    PLM_UCMD (0x0858001), PLM_UCMD (0x0040020), PLM_UCMD (0x3200209),
+    PLM_UCMD (0x08000C0), PLM_UCMD (0x4000020), PLM_UCMD (0x0600081),
+    PLM_UCMD (0x1000000), PLM_UCMD (0x1000180),
 };
 
 static const unsigned int ik1303_cmd_rom[256] = {
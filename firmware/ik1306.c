@@ -3,24 +3,30 @@
  * Using data from emu145 project by Felix Lazarev:
  * https://code.google.com/p/emu145/
  */
-static const unsigned int ik1306_ucmd_rom[] = {
-    0x0000000, 0x0800008, 0x0040020, 0x0800001,
-    0x0800021, 0x0080020, 0x0A00028, 0x0040100,
-    0x4000100, 0x0010100, 0x0A00101, 0x0201089,
-    0x0213201, 0x0800004, 0x0800800, 0x0800820,
-    0x0200088, 0x4810002, 0x0A00820, 0x0800400,
-    0x0801000, 0x0100000, 0x8800004, 0x0008000,
-    0x1400020, 0x0800005, 0x4000020, 0x0A00180,
-    0x0100000, 0x4000001, 0x8241004, 0x0400000,
-    0x0080001, 0x0040001, 0x0212801, 0x0200808,
-    0x0800000, 0x0010020, 0x0A00808, 0x0040090,
-    0x0A01008, 0x0800401, 0x0A00081, 0x0A01081,
-    0x0803400, 0x0A01001, 0x0A11801, 0x0011001,
-    0x0A10801, 0x0213801, 0x0098001, 0x0818001,
-    0x0800420, 0x0880090, 0x0203C08, 0x0200809,
-    0x0A00089, 0x0203090, 0x0840090, 0x0810002,
-    0x0210801, 0x0210081, 0x0010000, 0x0200090,
-    0x0210081, 0x0212801, 0x0A01020, 0x0A01020,
+static const plm_ucmd_t ik1306_ucmd_rom[] = {
+    PLM_UCMD (0x0000000), PLM_UCMD (0x0800008), PLM_UCMD (0x0040020),
+    PLM_UCMD (0x0800001), PLM_UCMD (0x0800021), PLM_UCMD (0x0080020),
+    PLM_UCMD (0x0A00028), PLM_UCMD (0x0040100), PLM_UCMD (0x4000100),
+    PLM_UCMD (0x0010100), PLM_UCMD (0x0A00101), PLM_UCMD (0x0201089),
+    PLM_UCMD (0x0213201), PLM_UCMD (0x0800004), PLM_UCMD (0x0800800),
+    PLM_UCMD (0x0800820), PLM_UCMD (0x0200088), PLM_UCMD (0x4810002),
+    PLM_UCMD (0x0A00820), PLM_UCMD (0x0800400), PLM_UCMD (0x0801000),
+    PLM_UCMD (0x0100000), PLM_UCMD (0x8800004), PLM_UCMD (0x0008000),
+    PLM_UCMD (0x1400020), PLM_UCMD (0x0800005), PLM_UCMD (0x4000020),
+    PLM_UCMD (0x0A00180), PLM_UCMD (0x0100000), PLM_UCMD (0x4000001),
+    PLM_UCMD (0x8241004), PLM_UCMD (0x0400000), PLM_UCMD (0x0080001),
+    PLM_UCMD (0x0040001), PLM_UCMD (0x0212801), PLM_UCMD (0x0200808),
+    PLM_UCMD (0x0800000), PLM_UCMD (0x0010020), PLM_UCMD (0x0A00808),
+    PLM_UCMD (0x0040090), PLM_UCMD (0x0A01008), PLM_UCMD (0x0800401),
+    PLM_UCMD (0x0A00081), PLM_UCMD (0x0A01081), PLM_UCMD (0x0803400),
+    PLM_UCMD (0x0A01001), PLM_UCMD (0x0A11801), PLM_UCMD (0x0011001),
+    PLM_UCMD (0x0A10801), PLM_UCMD (0x0213801), PLM_UCMD (0x0098001),
+    PLM_UCMD (0x0818001), PLM_UCMD (0x0800420), PLM_UCMD (0x0880090),
+    PLM_UCMD (0x0203C08), PLM_UCMD (0x0200809), PLM_UCMD (0x0A00089),
+    PLM_UCMD (0x0203090), PLM_UCMD (0x0840090), PLM_UCMD (0x0810002),
+    PLM_UCMD (0x0210801), PLM_UCMD (0x0210081), PLM_UCMD (0x0010000),
+    PLM_UCMD (0x0200090), PLM_UCMD (0x0210081), PLM_UCMD (0x0212801),
+    PLM_UCMD (0x0A01020), PLM_UCMD (0x0A01020),
 };
 
 static const unsigned int ik1306_cmd_rom[256] = {
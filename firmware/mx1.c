@@ -177,6 +177,7 @@ static inline void data (int on)
         TRISBSET = PIN(0);              // tristate
 }
 
+static calc_t calc;                     // Calculator state
 static unsigned rgd;                    // Radians/grads/degrees
 static unsigned keycode;                // Code of pressed button
 static unsigned key_pressed;            // Bitmask of active key
@@ -270,7 +271,7 @@ int scan_keys (int row)
  * Show the next display symbol.
  * Index counter is in range 0..11.
  */
-void calc_display (int i, int digit, int dot)
+static void calc_display (void *arg, int i, int digit, int dot)
 {
     clear_segments();
     if (i >= 0) {
@@ -293,28 +294,11 @@ void calc_display (int i, int digit, int dot)
             } else {
                 key_pressed &= ~(1 << i);
             }
+            calc_set_input (&calc, key_pressed ? keycode : 0, rgd);
         }
     }
 }
 
-/*
- * Poll the radians/grads/degrees switch.
- */
-int calc_rgd()
-{
-    return rgd;
-}
-
-/*
- * Poll the keypad.
- */
-int calc_keypad()
-{
-    if (! key_pressed)
-        return 0;
-    return keycode;
-}
-
 /*
  * Copy an array.
  */
@@ -327,14 +311,6 @@ void memcopy (void *from, void *to, unsigned nbytes)
         *dst++ = *src++;
 }
 
-/*
- * Poll the USB port.
- */
-void calc_poll()
-{
-    /* Empty */
-}
-
 /*
  * Perform non-volatile memory operation.
  */
@@ -436,6 +412,13 @@ void save_prog()
     clear_segments();
 }
 
+/*
+ * Functions, called by the calculator.
+ */
+static const calc_callbacks_t callbacks = {
+    calc_display, 0, 0, 0,
+};
+
 int main()
 {
     /* Initialize coprocessor 0. */
@@ -489,7 +472,7 @@ int main()
         clk();
     data (-1);                          // tristate data
 
-    calc_init();
+    calc_init (&calc, &callbacks, 0);
     rgd = MODE_DEGREES;
     keycode = 0;
     key_pressed = 0;
@@ -504,19 +487,19 @@ int main()
 
 #if 1
     for (;;) {
-        // Simulate one cycle of the calculator.
-        int running = calc_step();
+        // Simulate one step of the calculator.
+        int running = calc_step (&calc);
 
         if (running)
             continue;
 
         if (new_prog_flag) {
             // Got new program code - send ot to calculator engine.
-            calc_write_code (new_prog);
+            calc_write_code (&calc, new_prog);
             new_prog_flag = 0;
         } else {
             // Fetch program code.
-            calc_get_code (prog);
+            calc_get_code (&calc, prog);
 
             // Check when program has been changed and save it
             // to flash memory.
@@ -534,8 +517,8 @@ int main()
 #else
     int next = 0;
     for (;;) {
-        // Simulate one cycle of the calculator.
-        int running = calc_step();
+        // Simulate one step of the calculator.
+        int running = calc_step (&calc);
 
         // Simple test.
         static const unsigned char test[] = {
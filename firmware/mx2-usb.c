@@ -209,11 +209,11 @@ static inline void data (int on)
         TRISBSET = PIN(0);              // tristate
 }
 
+static calc_t calc;                     // Calculator state
 static unsigned rgd;                    // Radians/grads/degrees
 static unsigned keycode;                // Code of pressed button
 static unsigned key_pressed;            // Bitmask of active key
-static unsigned char stack[5][6];       // Stack values X, Y, Z, T, X1
-static unsigned char regs[DATA_NREGS][6]; // Memory registers 0..9, A..D
+static calc_view_t view;                // Stack, registers and program
 static unsigned char prog[CODE_NBYTES]; // Program code
 static unsigned char new_prog[CODE_NBYTES]; // New program code
 static int new_prog_flag;               // New program received
@@ -304,7 +304,7 @@ int scan_keys (int row)
  * Show the next display symbol.
  * Index counter is in range 0..11.
  */
-void calc_display (int i, int digit, int dot)
+static void calc_display (void *arg, int i, int digit, int dot)
 {
     clear_segments();
     if (i >= 0) {
@@ -327,28 +327,11 @@ void calc_display (int i, int digit, int dot)
             } else {
                 key_pressed &= ~(1 << i);
             }
+            calc_set_input (&calc, key_pressed ? keycode : 0, rgd);
         }
     }
 }
 
-/*
- * Poll the radians/grads/degrees switch.
- */
-int calc_rgd()
-{
-    return rgd;
-}
-
-/*
- * Poll the keypad.
- */
-int calc_keypad()
-{
-    if (! key_pressed)
-        return 0;
-    return keycode;
-}
-
 /*
  * Clear an array.
  */
@@ -391,7 +374,7 @@ static int handle_packet()
         send[0] = receive[0];
         send[1] = 2 + 6*5;
         for (i=0; i<5; i++) {
-            memcopy (&stack[i], &send[2 + i*6], 6);
+            calc_view_stack (&view, i, &send[2 + i*6]);
         }
         return 1;
     case CMD_READ_REG_LOW:      // Read registers 0..7
@@ -399,7 +382,7 @@ static int handle_packet()
         send[0] = receive[0];
         send[1] = 2 + 6 * 8;
         for (i=0; i<8; i++) {
-            memcopy (&regs[i], &send[2 + i*6], 6);
+            calc_view_reg (&view, i, &send[2 + i*6]);
         }
         return 1;
     case CMD_READ_REG_HIGH:     // Read registers 8..D or E
@@ -407,7 +390,7 @@ static int handle_packet()
         send[0] = receive[0];
         send[1] = 2 + 6 * (DATA_NREGS - 8);
         for (i=0; i<DATA_NREGS-8; i++) {
-            memcopy (&regs[i+8], &send[2 + i*6], 6);
+            calc_view_reg (&view, i+8, &send[2 + i*6]);
         }
         return 1;
     case CMD_READ_PROG_LOW:     // Read program code 0..59
@@ -442,7 +425,7 @@ static int handle_packet()
 /*
  * Poll the USB port.
  */
-void calc_poll()
+static void calc_poll (void *arg)
 {
     // Check bus status and service USB interrupts.
     usb_device_tasks();
@@ -579,6 +562,13 @@ void save_prog()
     clear_segments();
 }
 
+/*
+ * Functions, called by the calculator.
+ */
+static const calc_callbacks_t callbacks = {
+    calc_display, 0, 0, calc_poll,
+};
+
 /*
  * Main program entry point.
  */
@@ -635,7 +625,16 @@ int main()
         clk();
     data (-1);                          // tristate data
 
-    calc_init();
+    calc_init (&calc, &callbacks, 0);
+    // USB is polled once per display scan of 14 words.  The scan
+    // must take less than 20 msec, or the display flickers, so this
+    // is also the bound of the USB latency: below the 50 msec,
+    // allowed by USB 2.0 for a standard request without data stage.
+    // Meanwhile the hardware answers NAK and the host retries.
+    // Polling every word would take 14 times more calls to
+    // usb_device_tasks() from the simulation.
+    calc_set_poll_quantum (&calc, 14);
+    calc_view_init (&view, &calc);
     rgd = MODE_DEGREES;
     keycode = 0;
     key_pressed = 0;
@@ -654,22 +653,20 @@ int main()
     usb_device_init();
 
     for (;;) {
-        // Simulate one cycle of the calculator.
-        int running = calc_step();
+        // Simulate one step of the calculator.
+        int running = calc_step (&calc);
 
-        // Fetch data stack and registers.
-        calc_get_stack (stack);
-        calc_get_regs (regs);
         if (running)
             continue;
 
         if (new_prog_flag) {
             // Got new program code - send ot to calculator engine.
-            calc_write_code (new_prog);
+            calc_write_code (&calc, new_prog);
             new_prog_flag = 0;
         } else {
-            // Fetch program code.
-            calc_get_code (prog);
+            // Fetch program code, when changed.
+            if (calc_view_changed (&view) & CALC_VIEW_CODE)
+                calc_get_code (&calc, prog);
 
             // Check when program has been changed and save it
             // to flash memory.
@@ -145,6 +145,7 @@ static inline void data (int on)
         LATFCLR = PIN(1);               // clear data
 }
 
+static calc_t calc;                     // Calculator state
 static unsigned rgd;                    // Radians/grads/degrees
 static unsigned keycode;                // Code of pressed button
 static unsigned key_pressed;            // Bitmask of active key
@@ -223,7 +224,7 @@ int scan_keys (int row)
 // Show the next display symbol.
 // Index counter is in range 0..11.
 //
-void calc_display (int i, int digit, int dot)
+static void calc_display (void *arg, int i, int digit, int dot)
 {
     clear_segments();
     if (i >= 0) {
@@ -244,27 +245,17 @@ void calc_display (int i, int digit, int dot)
             } else {
                 key_pressed &= ~(1 << i);
             }
+            calc_set_input (&calc, key_pressed ? keycode : 0, rgd);
         }
     }
 }
 
 //
-// Poll the radians/grads/degrees switch.
+// Functions, called by the calculator.
 //
-int calc_rgd()
-{
-    return rgd;
-}
-
-//
-// Poll the keypad.
-//
-int calc_keypad()
-{
-    if (! key_pressed)
-        return 0;
-    return keycode;
-}
+static const calc_callbacks_t callbacks = {
+    calc_display, 0, 0, 0,
+};
 
 int main()
 {
@@ -314,14 +305,14 @@ int main()
     for (i=0; i<16; i++)                // clear register
         clk();
 
-    calc_init();
+    calc_init (&calc, &callbacks, 0);
     rgd = MODE_DEGREES;
     keycode = 0;
     key_pressed = 0;
 
     for (;;) {
-        // Simulate one cycle of the calculator.
-        int running = calc_step();
+        // Simulate one step of the calculator.
+        int running = calc_step (&calc);
 #if 1
         // Simple test.
         static int next;
@@ -0,0 +1,509 @@
+/*
+ * Kernel for NLANES calculators in lockstep.
+ * Included by simd.c for every supported number of lanes;
+ * names get suffix SIMD_SUFFIX.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#define V           SIMD_NAME (vec_t)
+#define PLM         SIMD_NAME (plm_t)
+#define MACHINE     SIMD_NAME (machine_t)
+
+//
+// One nibble (or flag) per lane.
+//
+typedef unsigned char V __attribute__ ((vector_size (NLANES)));
+
+//
+// PLM chip, as plm_t.
+//
+typedef struct {
+    V R [REG_NWORDS];                   // R register
+    V ST [REG_NWORDS];                  // ST register
+    V S;
+    V Q;
+    V carry;
+    V keypad_event;
+    V keyb_x;
+    V keyb_y;
+    V dot;
+    V enable_display;
+    V show_dot [14];
+    V kmask;                            // Command has keypad bits
+    V rmask;                            // Command has no modifier
+    unsigned command [NLANES];
+    const unsigned char *trace [NLANES]; // Traces of current commands
+    int uniform;                        // All lanes run the same command
+    plm_rom_t *rom;
+} PLM;
+
+typedef struct {
+    PLM ik1302;
+    PLM ik1303;
+#ifndef MK_54
+    PLM ik1306;
+#endif
+    V ring [RING_NWORDS * REG_NWORDS];  // Memory ring, as in calc_t
+} MACHINE;
+
+//
+// Select lanes from a, when mask m is set, else from b.
+//
+static inline __attribute__((always_inline))
+V SIMD_NAME (blend) (V m, V a, V b)
+{
+    return (a & m) | (b & ~m);
+}
+
+//
+// Set all lanes to a value.
+//
+static inline __attribute__((always_inline))
+V SIMD_NAME (splat) (unsigned x)
+{
+    V v = {};
+
+    return v + (unsigned char) x;
+}
+
+//
+// Check whether any lane of a mask is set.
+//
+static inline __attribute__((always_inline))
+int SIMD_NAME (any) (const V *m)
+{
+    unsigned long long w [(NLANES + 7) / 8];
+    unsigned i;
+
+    __builtin_memcpy (w, m, NLANES);
+    for (i=1; i<NLANES/8; i++)
+        w[0] |= w[i];
+    return w[0] != 0;
+}
+
+//
+// Execute a micro-instruction on the lanes selected by mask sel,
+// with M register in the memory ring.
+// Keypad masks are computed by the caller:
+// kopq - op UCMD_KEYPAD loads Q from keyb_y;
+// pollq - keypad poll loads Q from keyb_y.
+//
+static inline __attribute__((always_inline))
+void SIMD_NAME (plm_exec) (PLM *t, V M[], unsigned cycle,
+    const plm_ucmd_t *u, V sel, V kopq, V pollq)
+{
+    unsigned op = u->op;
+    V S = t->S;
+    V Q = t->Q;
+    V carry = t->carry;
+    V r = t->R[cycle];
+    V alpha, beta, gamma, sum, x;
+
+    if (op & UCMD_OP(UCMD_KEYPAD))
+        Q = SIMD_NAME (blend) (kopq, t->keyb_y, Q);
+
+    alpha = (r & (unsigned char) u->alpha) |
+            (M[cycle] & (unsigned char) (u->alpha >> 4)) |
+            (t->ST[cycle] & (unsigned char) (u->alpha >> 8)) |
+            ((r ^ 0xf) & (unsigned char) (u->alpha >> 12)) |
+            (S & (unsigned char) (u->alpha >> 16)) |
+            (unsigned char) ((u->alpha >> 20) & 0xf) |
+            ((carry - 1) & (unsigned char) (u->alpha >> 24));
+    beta = (S & (unsigned char) u->beta) |
+           ((S ^ 0xf) & (unsigned char) (u->beta >> 4)) |
+           (Q & (unsigned char) (u->beta >> 8)) |
+           (unsigned char) (u->beta >> 12);
+
+    // Keypad poll overrides Q after beta.
+    Q = SIMD_NAME (blend) (pollq, t->keyb_y, Q);
+
+    gamma = (carry & (unsigned char) (op & 1)) |
+            ((carry ^ 1) & (unsigned char) ((op >> 1) & 1)) |
+            ((t->keypad_event ^ 1) & (unsigned char) ((op >> 2) & 1));
+
+    sum = alpha + beta + gamma;
+    if (op & UCMD_OP(UCMD_CARRY_SUM))
+        carry = (sum >> 4) & 1;
+    sum &= 0xf;
+
+    if (op & (UCMD_OP(UCMD_R_MASK) | UCMD_OP(UCMD_R1_SUM) | UCMD_OP(UCMD_R2_SUM))) {
+        V rsel = (cycle >= 36) ? sel : sel & t->rmask;
+        unsigned cycle_plus_3 = cycle + 3;
+        unsigned cycle_minus_1 = cycle - 1 + REG_NWORDS;
+        unsigned cycle_minus_2 = cycle - 2 + REG_NWORDS;
+        if (cycle_plus_3 >= REG_NWORDS)
+            cycle_plus_3 -= REG_NWORDS;
+        if (cycle_minus_1 >= REG_NWORDS)
+            cycle_minus_1 -= REG_NWORDS;
+        if (cycle_minus_2 >= REG_NWORDS)
+            cycle_minus_2 -= REG_NWORDS;
+
+        x = r;
+        switch (op & UCMD_OP(UCMD_R_MASK)) {
+        case UCMD_OP(UCMD_R_R3):    x  = t->R[cycle_plus_3];    break;
+        case UCMD_OP(UCMD_R_SUM):   x  = sum;                   break;
+        case UCMD_OP(UCMD_R_S):     x  = S;                     break;
+        case UCMD_OP(UCMD_R_RSSUM): x |= S | sum;               break;
+        case UCMD_OP(UCMD_R_SSUM):  x  = S | sum;               break;
+        case UCMD_OP(UCMD_R_RS):    x |= S;                     break;
+        case UCMD_OP(UCMD_R_RSUM):  x |= sum;                   break;
+        }
+        t->R[cycle] = SIMD_NAME (blend) (rsel, x, r);
+        if (op & UCMD_OP(UCMD_R1_SUM))
+            t->R[cycle_minus_1] = SIMD_NAME (blend) (rsel, sum, t->R[cycle_minus_1]);
+        if (op & UCMD_OP(UCMD_R2_SUM))
+            t->R[cycle_minus_2] = SIMD_NAME (blend) (rsel, sum, t->R[cycle_minus_2]);
+    }
+
+    if (op & UCMD_OP(UCMD_M_S))
+        M[cycle] = SIMD_NAME (blend) (sel, S, M[cycle]);
+
+    switch (op & UCMD_OP(UCMD_S_MASK)) {
+    case UCMD_OP(UCMD_S_Q):    S = Q;          break;
+    case UCMD_OP(UCMD_S_SUM):  S = sum;        break;
+    case UCMD_OP(UCMD_S_QSUM): S = Q | sum;    break;
+    }
+
+    if (op & UCMD_OP(UCMD_Q_SUM))
+        Q = sum;
+
+    if (op & (UCMD_OP(UCMD_ST_SUM) | UCMD_OP(UCMD_ST_ROT))) {
+        unsigned cycle_plus_1 = cycle + 1;
+        unsigned cycle_plus_2 = cycle + 2;
+        if (cycle_plus_1 >= REG_NWORDS)
+            cycle_plus_1 = 0;
+        if (cycle_plus_2 >= REG_NWORDS)
+            cycle_plus_2 -= REG_NWORDS;
+
+        V st0 = t->ST[cycle];
+        V st1 = t->ST[cycle_plus_1];
+        V st2 = t->ST[cycle_plus_2];
+        V n0 = st0, n1 = st1, n2 = st2;
+
+        if (op & UCMD_OP(UCMD_ST_SUM)) {
+            n2 = n1;
+            n1 = n0;
+            n0 = sum;
+        }
+        if (op & UCMD_OP(UCMD_ST_ROT)) {
+            x = n0;
+            n0 = n1;
+            n1 = n2;
+            n2 = x;
+        }
+        t->ST[cycle]        = SIMD_NAME (blend) (sel, n0, st0);
+        t->ST[cycle_plus_1] = SIMD_NAME (blend) (sel, n1, st1);
+        t->ST[cycle_plus_2] = SIMD_NAME (blend) (sel, n2, st2);
+    }
+    t->S = SIMD_NAME (blend) (sel, S, t->S);
+    t->Q = SIMD_NAME (blend) (sel, Q, t->Q);
+    t->carry = SIMD_NAME (blend) (sel, carry, t->carry);
+}
+
+//
+// Lanes run different commands: get the micro-instruction address
+// of every lane, and execute every distinct micro-instruction
+// on its own lanes.
+//
+static __attribute__((noinline))
+void SIMD_NAME (plm_diverge) (PLM *t, V M[], unsigned cycle,
+    const V *kopq, const V *pollq)
+{
+    unsigned char addr [NLANES], done [NLANES];
+    V a, sel;
+    unsigned i, k;
+
+    for (i=0; i<NLANES; i++) {
+        unsigned inst_addr = t->trace[i][cycle];
+        addr[i] = (inst_addr & ~TRACE_NCARRY) +
+                  ((inst_addr >> 7) & (t->carry[i] ^ 1));
+        done[i] = 0;
+    }
+    __builtin_memcpy (&a, addr, NLANES);
+    for (i=0; i<NLANES; i++) {
+        if (done[i])
+            continue;
+        sel = (V) (a == addr[i]);
+        for (k=i; k<NLANES; k++)
+            done[k] |= sel[k];
+        SIMD_NAME (plm_exec) (t, M, cycle, &t->rom->ucmd[addr[i]], sel,
+            *kopq, *pollq);
+    }
+}
+
+//
+// Simulate one cycle of the PLM chip on all lanes,
+// except for the input/output.
+//
+static inline __attribute__((always_inline))
+void SIMD_NAME (plm_cycle) (PLM *t, V M[], unsigned cycle)
+{
+    /* D stage in range 0...13 */
+    unsigned d = cycle / 3;
+    unsigned i;
+
+    /*
+     * Fetch program counter from the R register.
+     */
+    if (cycle == 0) {
+        unsigned uniform = 1;
+
+        for (i=0; i<NLANES; i++) {
+            unsigned pc = t->R[36][i] + (t->R[39][i] << 4);
+            unsigned command = t->rom->cmd_rom[pc];
+
+            t->command[i] = command;
+            t->trace[i] = plm_trace (t->rom, pc);
+            t->kmask[i] = (command & 0xfc0000) ? 0xff : 0;
+            t->rmask[i] = (command >> 24) ? 0 : 0xff;
+            uniform &= (command == t->command[0]);
+        }
+        t->uniform = uniform;
+        t->keypad_event &= t->kmask;
+    }
+
+    /*
+     * Extended address of the command is loaded into R register.
+     */
+    if (cycle == 36) {
+        for (i=0; i<NLANES; i++) {
+            unsigned prog_index = (t->command[i] >> 16) & 0xff;
+            if (prog_index > 0x1f) {
+                t->R[37][i] = prog_index & 0xf;
+                t->R[40][i] = prog_index >> 4;
+            }
+        }
+    }
+
+    /*
+     * Poll keypad.  It does not depend on the micro-instruction,
+     * so it is computed once for all lanes.
+     */
+    V notk = ~t->kmask;
+    V dmatch = (V) (t->keyb_x == (unsigned char) (d + 1));
+    V ypos = (V) (t->keyb_y != 0);
+    V kopq = ~dmatch & ypos;
+    V pollq = notk & dmatch & ypos;
+    V carry = t->carry;
+
+    t->keypad_event = SIMD_NAME (blend) (t->kmask & ~ypos,
+        SIMD_NAME (splat) (0), t->keypad_event);
+    t->keypad_event = SIMD_NAME (blend) (pollq,
+        SIMD_NAME (splat) (1), t->keypad_event);
+    t->enable_display = SIMD_NAME (blend) (notk,
+        SIMD_NAME (splat) (1), t->enable_display);
+    if (d < 12)
+        t->dot = SIMD_NAME (blend) (notk & (V) (carry != 0),
+            SIMD_NAME (splat) (d), t->dot);
+    t->show_dot[d] = SIMD_NAME (blend) (notk, carry, t->show_dot[d]);
+
+    /*
+     * Execute the micro-instruction.  With the same command on all lanes,
+     * it can differ only by carry.
+     */
+    if (! t->uniform) {
+        SIMD_NAME (plm_diverge) (t, M, cycle, &kopq, &pollq);
+
+    } else {
+        unsigned inst_addr = t->trace[0][cycle];
+
+        if (! (inst_addr & TRACE_NCARRY)) {
+            SIMD_NAME (plm_exec) (t, M, cycle, &t->rom->ucmd[inst_addr],
+                SIMD_NAME (splat) (0xff), kopq, pollq);
+        } else {
+            V c1 = (V) (carry != 0);
+            V c0 = ~c1;
+
+            inst_addr &= ~TRACE_NCARRY;
+            if (SIMD_NAME (any) (&c1))
+                SIMD_NAME (plm_exec) (t, M, cycle, &t->rom->ucmd[inst_addr],
+                    c1, kopq, pollq);
+            if (SIMD_NAME (any) (&c0))
+                SIMD_NAME (plm_exec) (t, M, cycle,
+                    &t->rom->ucmd[inst_addr + 1], c0, kopq, pollq);
+        }
+    }
+}
+
+//
+// Simulate a word of the PLM chip on all lanes, with M register
+// in the memory ring, as plm_run_word().
+//
+static inline __attribute__((always_inline))
+void SIMD_NAME (plm_run_word) (PLM *t, V M[])
+{
+    unsigned i;
+
+    SIMD_NAME (plm_cycle) (t, M, 0);
+    SIMD_NAME (plm_cycle) (t, M, 1);
+    for (i=2; i<36; i++)
+        SIMD_NAME (plm_cycle) (t, M, i);
+    SIMD_NAME (plm_cycle) (t, M, 36);
+    SIMD_NAME (plm_cycle) (t, M, 37);
+    SIMD_NAME (plm_cycle) (t, M, 38);
+    SIMD_NAME (plm_cycle) (t, M, 39);
+    SIMD_NAME (plm_cycle) (t, M, 40);
+    SIMD_NAME (plm_cycle) (t, M, 41);
+}
+
+//
+// Simulate one step of all calculators, as calc_step(),
+// and move the head of the memory ring.  Chips are computed
+// in a loop, so that the kernel is expanded only once.
+//
+static unsigned SIMD_NAME (step) (void *arg, unsigned *head,
+    const unsigned char keycode[], const unsigned char rgd[])
+{
+    MACHINE *m = arg;
+    PLM *chip [3];
+    unsigned pos [3];
+    unsigned k, i, n, running;
+
+    chip[0] = &m->ik1302;
+    chip[1] = &m->ik1303;
+    pos[0] = RING_IK1302;
+    pos[1] = RING_IK1303;
+#ifdef MK_54
+    n = 2;
+#else
+    chip[2] = &m->ik1306;
+    pos[2] = RING_IK1306;
+    n = 3;
+#endif
+    for (i=0; i<NLANES; i++) {
+        m->ik1302.keyb_x[i] = keycode[i] >> 4;
+        m->ik1302.keyb_y[i] = keycode[i] & 0xf;
+        m->ik1303.keyb_x[i] = rgd[i];
+        m->ik1303.keyb_y[i] = 1;
+    }
+
+    for (k=0; k<STEP_NWORDS; k++) {
+        for (i=0; i<n; i++)
+            SIMD_NAME (plm_run_word) (chip[i], m->ring +
+                (*head + pos[i]) % RING_NWORDS * REG_NWORDS);
+
+        // Move the head, as calc_shift_ring().
+        (*head)++;
+        if (*head >= RING_NWORDS)
+            *head = 0;
+
+        // Display is cleared in manual mode, as by calc_step().
+        if (k % 14 < 12)
+            m->ik1302.enable_display = SIMD_NAME (blend) (
+                (V) (m->ik1302.dot == 11), m->ik1302.enable_display,
+                SIMD_NAME (splat) (0));
+    }
+    running = 0;
+    for (i=0; i<NLANES; i++)
+        if (m->ik1302.dot[i] == 11)
+            running |= 1u << i;
+    return running;
+}
+
+//
+// Copy PLM state between a calculator and a lane.
+//
+static void SIMD_NAME (plm_load) (PLM *t, int lane, const plm_t *p)
+{
+    unsigned i;
+
+    for (i=0; i<REG_NWORDS; i++) {
+        t->R[i][lane] = p->R[i];
+        t->ST[i][lane] = p->ST[i];
+    }
+    t->S[lane] = p->S;
+    t->Q[lane] = p->Q;
+    t->carry[lane] = p->carry;
+    t->keypad_event[lane] = p->keypad_event;
+    t->keyb_x[lane] = p->keyb_x;
+    t->keyb_y[lane] = p->keyb_y;
+    t->dot[lane] = p->dot;
+    t->enable_display[lane] = p->enable_display;
+    for (i=0; i<14; i++)
+        t->show_dot[i][lane] = p->show_dot[i];
+    t->command[lane] = p->command;
+    t->trace[lane] = p->trace;
+    t->kmask[lane] = (p->command & 0xfc0000) ? 0xff : 0;
+    t->rmask[lane] = (p->command >> 24) ? 0 : 0xff;
+    t->uniform = 0;
+    t->rom = p->rom;
+}
+
+static void SIMD_NAME (plm_store) (PLM *t, int lane, plm_t *p)
+{
+    unsigned i;
+
+    for (i=0; i<REG_NWORDS; i++) {
+        p->R[i] = t->R[i][lane];
+        p->ST[i] = t->ST[i][lane];
+    }
+    p->S = t->S[lane];
+    p->Q = t->Q[lane];
+    p->carry = t->carry[lane];
+    p->keypad_event = t->keypad_event[lane];
+    p->keyb_x = t->keyb_x[lane];
+    p->keyb_y = t->keyb_y[lane];
+    p->dot = t->dot[lane];
+    p->enable_display = t->enable_display[lane];
+    for (i=0; i<14; i++)
+        p->show_dot[i] = t->show_dot[i][lane];
+    p->command = t->command[lane];
+    p->trace = t->trace[lane];
+}
+
+//
+// Copy the state of a calculator to a lane.  The head of the ring
+// is the same for all lanes, so the ring is copied as is.
+//
+static void SIMD_NAME (load) (void *arg, int lane, const calc_t *c)
+{
+    MACHINE *m = arg;
+    unsigned i;
+
+    SIMD_NAME (plm_load) (&m->ik1302, lane, &c->ik1302);
+    SIMD_NAME (plm_load) (&m->ik1303, lane, &c->ik1303);
+#ifndef MK_54
+    SIMD_NAME (plm_load) (&m->ik1306, lane, &c->ik1306);
+#endif
+    for (i=0; i<RING_NWORDS * REG_NWORDS; i++)
+        m->ring[i][lane] = c->ring[i];
+}
+
+//
+// Copy the state of a lane to a calculator.
+//
+static void SIMD_NAME (store) (void *arg, int lane, calc_t *c)
+{
+    MACHINE *m = arg;
+    unsigned i;
+
+    SIMD_NAME (plm_store) (&m->ik1302, lane, &c->ik1302);
+    SIMD_NAME (plm_store) (&m->ik1303, lane, &c->ik1303);
+#ifndef MK_54
+    SIMD_NAME (plm_store) (&m->ik1306, lane, &c->ik1306);
+#endif
+    for (i=0; i<RING_NWORDS * REG_NWORDS; i++)
+        c->ring[i] = m->ring[i][lane];
+}
+
+#undef V
+#undef PLM
+#undef MACHINE
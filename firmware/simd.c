@@ -0,0 +1,198 @@
+/*
+ * Simulator of many MK-61 calculators in lockstep, on SIMD lanes.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "calc.h"
+#include "simd.h"
+
+#ifndef PLM_TRACE_CACHE
+#error SIMD kernels need the trace cache
+#endif
+
+#define SIMD_PASTE2(a, b)   a ## _ ## b
+#define SIMD_PASTE(a, b)    SIMD_PASTE2 (a, b)
+#define SIMD_NAME(x)        SIMD_PASTE (x, SIMD_SUFFIX)
+
+//
+// Generic kernels: the compiler uses the vector instructions
+// of the base architecture, or plain integer instructions.
+//
+#define NLANES      16
+#define SIMD_SUFFIX generic16
+#include "simd-lanes.c"
+#undef NLANES
+#undef SIMD_SUFFIX
+
+#define NLANES      32
+#define SIMD_SUFFIX generic32
+#include "simd-lanes.c"
+#undef NLANES
+#undef SIMD_SUFFIX
+
+#if defined(__x86_64__) || defined(__i386__)
+//
+// Kernels for AVX2, selected at run time.
+//
+#define SIMD_AVX2
+#pragma GCC push_options
+#pragma GCC target ("avx2")
+
+#define NLANES      16
+#define SIMD_SUFFIX avx2_16
+#include "simd-lanes.c"
+#undef NLANES
+#undef SIMD_SUFFIX
+
+#define NLANES      32
+#define SIMD_SUFFIX avx2_32
+#include "simd-lanes.c"
+#undef NLANES
+#undef SIMD_SUFFIX
+
+#pragma GCC pop_options
+#endif
+
+//
+// Allocate a group of calculators.
+//
+simd_t *simd_create (int nlanes)
+{
+    simd_t *s;
+    size_t size;
+    int avx2 = 0;
+
+#ifdef SIMD_AVX2
+    __builtin_cpu_init();
+    avx2 = __builtin_cpu_supports ("avx2");
+#endif
+    s = calloc (1, sizeof(simd_t));
+    if (! s)
+        return 0;
+    s->nlanes = nlanes;
+
+    switch (nlanes) {
+    case 16:
+        size = sizeof(machine_t_generic16);
+        s->engine = "generic";
+        s->load = load_generic16;
+        s->store = store_generic16;
+        s->step = step_generic16;
+#ifdef SIMD_AVX2
+        if (avx2) {
+            s->engine = "avx2";
+            s->load = load_avx2_16;
+            s->store = store_avx2_16;
+            s->step = step_avx2_16;
+        }
+#endif
+        break;
+    case 32:
+        size = sizeof(machine_t_generic32);
+        s->engine = "generic";
+        s->load = load_generic32;
+        s->store = store_generic32;
+        s->step = step_generic32;
+#ifdef SIMD_AVX2
+        if (avx2) {
+            s->engine = "avx2";
+            s->load = load_avx2_32;
+            s->store = store_avx2_32;
+            s->step = step_avx2_32;
+        }
+#endif
+        break;
+    default:
+        free (s);
+        return 0;
+    }
+
+    // Vectors need alignment by their size.
+    size = (size + 63) & ~63;
+    s->machine = aligned_alloc (64, size);
+    if (! s->machine) {
+        free (s);
+        return 0;
+    }
+    memset (s->machine, 0, size);
+    return s;
+}
+
+//
+// Free the group.
+//
+void simd_free (simd_t *s)
+{
+    free (s->machine);
+    free (s);
+}
+
+//
+// Copy the state of a calculator to a lane.
+//
+int simd_load (simd_t *s, int lane, const calc_t *c)
+{
+    if (lane < 0 || lane >= s->nlanes)
+        return 0;
+    if (! s->loaded) {
+        s->head = c->head;
+        s->loaded = 1;
+    } else if (c->head != s->head)
+        return 0;
+
+    s->load (s->machine, lane, c);
+    s->keycode[lane] = c->ik1302.keyb_x << 4 | c->ik1302.keyb_y;
+    s->rgd[lane] = c->ik1303.keyb_x;
+    return 1;
+}
+
+//
+// Copy the state of a lane to a calculator.
+//
+void simd_store (simd_t *s, int lane, calc_t *c)
+{
+    if (lane < 0 || lane >= s->nlanes)
+        return;
+    c->head = s->head;
+    s->store (s->machine, lane, c);
+}
+
+//
+// Set the keypad state for a lane.
+//
+void simd_set_keypad (simd_t *s, int lane, int keycode, int rgd)
+{
+    if (lane < 0 || lane >= s->nlanes)
+        return;
+    s->keycode[lane] = keycode;
+    s->rgd[lane] = rgd;
+}
+
+//
+// Simulate one step of all calculators.
+//
+unsigned simd_step (simd_t *s)
+{
+    return s->step (s->machine, &s->head, s->keycode, s->rgd);
+}
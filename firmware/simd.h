@@ -0,0 +1,91 @@
+/*
+ * Simulator of many MK-61 calculators in lockstep, on SIMD lanes.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+
+//
+// Every register of the chips is stored as an array of lanes:
+// lane k of every nibble belongs to calculator k.  Calculators
+// can execute different commands: diverging lanes are computed
+// under masks.  Supported number of lanes is 16 or 32;
+// for other numbers, use calc_step() on every calculator.
+// There are no 8 lanes: a vector of 8 nibbles takes the same SSE
+// instructions as of 16, so it would run at half the throughput.
+//
+// The state is loaded from calc_t and stored back, so programs
+// are entered and results fetched with the usual calc_* functions.
+// Display is not simulated.
+//
+#define SIMD_MAXLANES   32
+
+typedef struct {
+    int nlanes;                         // Number of calculators
+    const char *engine;                 // Name of the selected kernel
+    void *machine;                      // State of lanes
+    unsigned head;                      // Head of the memory ring
+    int loaded;                         // Field head is set
+    unsigned char keycode [SIMD_MAXLANES]; // Keys pressed
+    unsigned char rgd [SIMD_MAXLANES];  // Radians/grads/degrees switch
+
+    // Kernels for the given number of lanes.
+    void (*load) (void *machine, int lane, const calc_t *c);
+    void (*store) (void *machine, int lane, calc_t *c);
+    unsigned (*step) (void *machine, unsigned *head,
+        const unsigned char keycode[], const unsigned char rgd[]);
+} simd_t;
+
+//
+// Allocate a group of calculators.  Select the kernel for
+// the current processor: AVX2 when available, or generic.
+// Return 0 when the number of lanes is not supported.
+//
+simd_t *simd_create (int nlanes);
+
+//
+// Free the group.
+//
+void simd_free (simd_t *s);
+
+//
+// Copy the state of a calculator to a lane.  All calculators
+// must have the same head of the memory ring, that is, must have
+// executed the same number of words, modulo the ring size.
+// Return 0 on mismatch.
+//
+int simd_load (simd_t *s, int lane, const calc_t *c);
+
+//
+// Copy the state of a lane to a calculator, initialized by calc_init().
+//
+void simd_store (simd_t *s, int lane, calc_t *c);
+
+//
+// Set the key pressed and the radians/grads/degrees switch
+// for a lane.  Keycode 0 means no key.
+//
+void simd_set_keypad (simd_t *s, int lane, int keycode, int rgd);
+
+//
+// Simulate one step of all calculators, as calc_step().
+// Return a bit mask of lanes which run a user program.
+//
+unsigned simd_step (simd_t *s);
@@ -0,0 +1,418 @@
+/*
+ * Batch execution of MK-61 programs on multiple cores.
+ * Every job runs on its own calculator; jobs are distributed
+ * between threads with work stealing.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "batch.h"
+
+#define MAXTHREADS      256
+
+//
+// Queue of jobs, owned by one thread: a range of job indices.
+// The owner takes jobs from the top, other threads steal
+// from the bottom.
+//
+typedef struct {
+    pthread_mutex_t lock;
+    unsigned lo, hi;
+} queue_t;
+
+//
+// Shared state of a batch.
+//
+typedef struct {
+    batch_job_t *jobs;
+    int nthreads;
+    queue_t queue [MAXTHREADS];
+    pthread_mutex_t done_lock;
+    batch_done_t done;
+    void *arg;
+} batch_t;
+
+//
+// Worker thread data.
+//
+typedef struct {
+    batch_t *batch;
+    int index;
+} worker_t;
+
+//
+// Get a nibble of the value: 0-2 exponent, 3 sign, 4-11 mantissa.
+//
+static inline unsigned nibble (const unsigned char value[6], int i)
+{
+    return (i & 1) ? (value[i/2] >> 4) : (value[i/2] & 15);
+}
+
+//
+// Press a key with calc_press_key(), and count the words
+// as steps, rounded up.  Return 0 on timeout.
+//
+static int press_key (calc_t *c, batch_job_t *job, int keycode)
+{
+    unsigned long n = 0;
+
+    if (job->steps < job->max_steps)
+        n = calc_press_key (c, keycode,
+            (unsigned long) (job->max_steps - job->steps) * STEP_NWORDS);
+    if (n == 0) {
+        job->steps = job->max_steps;
+        return 0;
+    }
+    job->steps += (n + STEP_NWORDS - 1) / STEP_NWORDS;
+    return 1;
+}
+
+//
+// Run a key script.  Keys are pressed by calc_press_key(),
+// so releases in the script are skipped.  Return 0 on timeout.
+//
+static int run_keys (calc_t *c, batch_job_t *job, const unsigned char *keys)
+{
+    while (*keys != 0xff) {
+        // Switch radians/grads/degrees mode.
+        if (*keys > 0 && *keys < 16) {
+            calc_set_input (c, 0, *keys++);
+            continue;
+        }
+        if (*keys != 0 && ! press_key (c, job, *keys))
+            return 0;
+        keys++;
+    }
+
+    // Refresh the display.
+    job->steps++;
+    calc_step (c);
+    return 1;
+}
+
+//
+// Run a single job on the current thread.
+//
+void batch_run_job (batch_job_t *job)
+{
+    calc_t c;
+    unsigned char regs [DATA_NREGS][6], stack [5][6], x1 [6];
+    int i;
+
+    // Headless: keys are pressed by calc_press_key(),
+    // and the display is decoded at the end.
+    calc_init (&c, 0, 0);
+    calc_set_headless (&c, 1);
+    if (job->state && calc_load_state (&c, job->state)) {
+        // Start from a prepared state, with the same mode switch.
+        job->steps = 0;
+    } else {
+        // Power on.
+        calc_warm_start (&c, MODE_DEGREES);
+        job->steps = 1;
+    }
+    calc_write_code (&c, job->code);
+
+    // Write registers directly to memory.
+    calc_get_regs (&c, regs);
+    for (i=0; i<DATA_NREGS; i++) {
+        if (job->regs_mask & (1 << i))
+            memcpy (regs[i], job->regs[i], 6);
+    }
+    calc_set_regs (&c, regs);
+
+    // The microcode keeps a copy of X in the working registers,
+    // so X is set through X1 by F Вx.  The keys are released
+    // as soon as taken.  F Вx lifts the stack,
+    // so Y, Z, T and X1 are written after it.
+    job->status = BATCH_TIMEOUT;
+    calc_get_stack (&c, stack);
+    if (job->stack_mask & 1) {
+        memcpy (x1, stack[0], 6);
+        memcpy (stack[0], job->stack[0], 6);
+        calc_set_stack (&c, stack);
+        if (! press_key (&c, job, KEY_F) || ! press_key (&c, job, KEY_ENTER))
+            goto done;
+        calc_get_stack (&c, stack);
+        memcpy (stack[0], x1, 6);
+    }
+    for (i=1; i<4; i++) {
+        if (job->stack_mask & (1 << i))
+            memcpy (stack[i+1], job->stack[i], 6);
+    }
+    calc_set_stack (&c, stack);
+
+    if (run_keys (&c, job, job->keys))
+        job->status = BATCH_STOPPED;
+done:
+    calc_get_stack (&c, job->result_stack);
+    calc_get_regs (&c, job->result_regs);
+    calc_get_display (&c, job->display, job->show_dot);
+}
+
+//
+// Take a job from own queue.
+//
+static int take_job (queue_t *q, unsigned *index)
+{
+    int found = 0;
+
+    pthread_mutex_lock (&q->lock);
+    if (q->lo < q->hi) {
+        *index = --q->hi;
+        found = 1;
+    }
+    pthread_mutex_unlock (&q->lock);
+    return found;
+}
+
+//
+// Steal a half of jobs from the victim queue into own queue.
+//
+static int steal_jobs (queue_t *victim, queue_t *q)
+{
+    unsigned lo, hi;
+
+    pthread_mutex_lock (&victim->lock);
+    lo = victim->lo;
+    hi = lo + (victim->hi - lo + 1) / 2;
+    victim->lo = hi;
+    pthread_mutex_unlock (&victim->lock);
+    if (lo == hi)
+        return 0;
+
+    pthread_mutex_lock (&q->lock);
+    q->lo = lo;
+    q->hi = hi;
+    pthread_mutex_unlock (&q->lock);
+    return 1;
+}
+
+//
+// Worker thread: run jobs from own queue, then steal from others.
+// Exit when all queues are empty.
+//
+static void *worker (void *arg)
+{
+    worker_t *w = arg;
+    batch_t *b = w->batch;
+    queue_t *q = &b->queue[w->index];
+    unsigned index;
+    int i;
+
+    for (;;) {
+        if (take_job (q, &index)) {
+            batch_run_job (&b->jobs[index]);
+            if (b->done) {
+                pthread_mutex_lock (&b->done_lock);
+                b->done (&b->jobs[index], b->arg);
+                pthread_mutex_unlock (&b->done_lock);
+            }
+            continue;
+        }
+        for (i=1; i<b->nthreads; i++) {
+            if (steal_jobs (&b->queue[(w->index + i) % b->nthreads], q))
+                break;
+        }
+        if (i >= b->nthreads)
+            return 0;
+    }
+}
+
+//
+// Run all jobs on a given number of threads (0 - one per core).
+// Return the number of threads used.
+//
+int batch_run (batch_job_t *jobs, unsigned njobs, int nthreads,
+    batch_done_t done, void *arg)
+{
+    batch_t b;
+    pthread_t tid [MAXTHREADS];
+    worker_t w [MAXTHREADS];
+    int i;
+
+    if (nthreads <= 0)
+        nthreads = sysconf (_SC_NPROCESSORS_ONLN);
+    if (nthreads > MAXTHREADS)
+        nthreads = MAXTHREADS;
+    if (nthreads > njobs)
+        nthreads = njobs;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    b.jobs = jobs;
+    b.nthreads = nthreads;
+    b.done = done;
+    b.arg = arg;
+    pthread_mutex_init (&b.done_lock, 0);
+
+    // Split jobs into equal ranges.
+    for (i=0; i<nthreads; i++) {
+        pthread_mutex_init (&b.queue[i].lock, 0);
+        b.queue[i].lo = (unsigned long long) njobs * i / nthreads;
+        b.queue[i].hi = (unsigned long long) njobs * (i+1) / nthreads;
+    }
+
+    for (i=0; i<nthreads; i++) {
+        w[i].batch = &b;
+        w[i].index = i;
+        if (i > 0)
+            pthread_create (&tid[i], 0, worker, &w[i]);
+    }
+    worker (&w[0]);
+    for (i=1; i<nthreads; i++)
+        pthread_join (tid[i], 0);
+
+    for (i=0; i<nthreads; i++)
+        pthread_mutex_destroy (&b.queue[i].lock);
+    pthread_mutex_destroy (&b.done_lock);
+    return nthreads;
+}
+
+//
+// Convert a decimal number like "-1.5e-3" to the calculator format.
+// Mantissa is truncated to 8 digits.  Numbers below 1e-99 are flushed
+// to zero, as by the calculator.  Return 0 on error or overflow.
+//
+int batch_parse_value (const char *str, unsigned char value[6])
+{
+    unsigned nib [12];
+    int negative = 0, exponent = 0, ndigits = 0, point = -1;
+    int i;
+
+    for (i=0; i<12; i++)
+        nib[i] = 0;
+    if (*str == '-') {
+        negative = 1;
+        str++;
+    } else if (*str == '+')
+        str++;
+
+    // Mantissa: skip leading zeros, remember position of the point.
+    for (; *str; str++) {
+        if (*str == '.') {
+            if (point >= 0)
+                return 0;
+            point = ndigits;
+        } else if (*str >= '0' && *str <= '9') {
+            if (ndigits == 0 && *str == '0') {
+                if (point >= 0)
+                    exponent--;
+                continue;
+            }
+            if (ndigits < 8)
+                nib[4 + ndigits] = *str - '0';
+            ndigits++;
+        } else
+            break;
+    }
+    if (point < 0)
+        point = ndigits;
+    if (*str == 'e' || *str == 'E') {
+        char *end;
+        exponent += strtol (str+1, &end, 10);
+        str = end;
+    }
+    if (*str != 0)
+        return 0;
+
+    if (ndigits > 0) {
+        exponent += point - 1;
+        if (exponent > 99)
+            return 0;
+        if (exponent < -99) {
+            // Underflow.
+            for (i=0; i<12; i++)
+                nib[i] = 0;
+            ndigits = 0;
+        }
+    }
+    if (ndigits > 0) {
+        if (negative)
+            nib[3] = 9;
+        if (exponent < 0) {
+            nib[0] = 9;
+            exponent += 100;
+        }
+        nib[1] = exponent / 10;
+        nib[2] = exponent % 10;
+    }
+    for (i=0; i<6; i++)
+        value[i] = nib[i+i] | nib[i+i+1] << 4;
+    return 1;
+}
+
+//
+// Convert a value in calculator format to text, like "-1.5e-03".
+// Buffer must have space for 16 bytes.
+//
+void batch_format_value (char *buf, const unsigned char value[6])
+{
+    static const char symbol[] = "0123456789-LCRE ";
+    int exponent = nibble (value, 1) * 10 + nibble (value, 2);
+    int i;
+
+    if (nibble (value, 0) == 9)
+        exponent = -(100 - exponent);
+
+    *buf++ = (nibble (value, 3) == 9) ? '-' : ' ';
+    for (i=0; i<8; i++) {
+        *buf++ = symbol [nibble (value, 4 + i)];
+        if (i == 0)
+            *buf++ = '.';
+    }
+    sprintf (buf, "e%+03d", exponent);
+}
+
+//
+// Convert a number to the calculator format, rounded to 8 digits.
+// Numbers below 1e-99 are flushed to zero.  Return 0 when the number
+// is too large, or not finite.
+//
+int batch_value_from_double (double d, unsigned char value[6])
+{
+    char buf [32];
+
+    snprintf (buf, sizeof(buf), "%.7e", d);
+    return batch_parse_value (buf, value);
+}
+
+//
+// Convert a value in calculator format to a number.
+// Return NaN when the mantissa has non-decimal digits.
+//
+double batch_value_to_double (const unsigned char value[6])
+{
+    char buf [16];
+    int i;
+
+    for (i=0; i<8; i++)
+        if (nibble (value, 4 + i) > 9)
+            return NAN;
+    batch_format_value (buf, value);
+    return strtod (buf, 0);
+}
@@ -0,0 +1,115 @@
+/*
+ * Batch execution of MK-61 programs on multiple cores.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include "calc.h"
+
+//
+// Maximum length of a key script.
+//
+#define BATCH_NKEYS     256
+
+//
+// Job status.
+//
+#define BATCH_STOPPED   1               // Program stopped, script finished
+#define BATCH_TIMEOUT   2               // Step limit exceeded
+
+//
+// One job: a program with initial data, and a key script
+// to run it.  Every job is executed on a separate calculator.
+// Initial data are written directly to the memory; X is set
+// as by F Вx, so the first digit of the script starts a new number.
+//
+typedef struct {
+    //
+    // Input.
+    //
+    unsigned char code [CODE_NBYTES];   // Program code
+    unsigned char regs [DATA_NREGS][6]; // Initial values of registers
+    unsigned short regs_mask;           // Which registers to set
+    unsigned char stack [4][6];         // Initial values of X, Y, Z, T
+    unsigned char stack_mask;           // Which stack levels to set
+    unsigned char keys [BATCH_NKEYS];   // Key script, as in test.c:
+                                        // key, 0 to release, or mode
+                                        // switch; ends with 0xff.
+                                        // Keys are released as soon
+                                        // as taken, so 0 is skipped
+    unsigned max_steps;                 // Limit of steps
+    const calc_state_t *state;          // Initial state, or 0 to power on
+    void *arg;                          // User data
+
+    //
+    // Result.
+    //
+    int status;                         // BATCH_STOPPED or BATCH_TIMEOUT
+    unsigned steps;                     // Steps of 560 words, rounded
+                                        // up for every key
+    unsigned char result_stack [5][6];  // X1, X, Y, Z, T
+    unsigned char result_regs [DATA_NREGS][6];
+    unsigned char display [12];         // Digits on the display
+    unsigned char show_dot [12];        // Decimal dots
+} batch_job_t;
+
+//
+// Function called for every finished job, in order of completion.
+// Calls are serialized.
+//
+typedef void (*batch_done_t) (batch_job_t *job, void *arg);
+
+//
+// Run all jobs on a given number of threads (0 - one per core).
+// Return the number of threads used.
+//
+int batch_run (batch_job_t *jobs, unsigned njobs, int nthreads,
+    batch_done_t done, void *arg);
+
+//
+// Run a single job on the current thread.
+//
+void batch_run_job (batch_job_t *job);
+
+//
+// Convert a decimal number like "-1.5e-3" to the calculator format.
+// Mantissa is truncated to 8 digits.  Numbers below 1e-99 are flushed
+// to zero, as by the calculator.  Return 0 on error or overflow.
+//
+int batch_parse_value (const char *str, unsigned char value[6]);
+
+//
+// Convert a value in calculator format to text.
+// Buffer must have space for 16 bytes.
+//
+void batch_format_value (char *buf, const unsigned char value[6]);
+
+//
+// Convert a number to the calculator format, rounded to 8 digits.
+// Numbers below 1e-99 are flushed to zero.  Return 0 when the number
+// is too large, or not finite.
+//
+int batch_value_from_double (double d, unsigned char value[6]);
+
+//
+// Convert a value in calculator format to a number.
+// Return NaN when the mantissa has non-decimal digits.
+//
+double batch_value_to_double (const unsigned char value[6]);
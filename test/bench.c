@@ -0,0 +1,299 @@
+/*
+ * Benchmark of MK-61 simulator: run a program and measure the speed.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "calc.h"
+#include "simd.h"
+#include "bitslice.h"
+#include "hle.h"
+
+extern int parse_prog (char *filename, unsigned char prog[]);
+
+unsigned keycode = 0;
+
+calc_t calc;
+
+//
+// Calculators for lanes, and their copies for verification.
+//
+calc_t lane_calc [BSLICE_NLANES];
+calc_t check_calc [BSLICE_NLANES];
+
+bslice_t bslice;
+
+//
+// Poll the radians/grads/degrees switch.
+//
+static int calc_rgd (void *arg)
+{
+    return MODE_DEGREES;
+}
+
+//
+// Poll the keypad.
+//
+static int calc_keypad (void *arg)
+{
+    return keycode;
+}
+
+//
+// Display is not needed for benchmarking.
+//
+static void calc_display (void *arg, int i, int digit, int dot)
+{
+}
+
+static const calc_callbacks_t callbacks = {
+    calc_display, calc_rgd, calc_keypad, 0,
+};
+
+//
+// Get current time in seconds.
+//
+static double now()
+{
+    struct timeval t;
+
+    gettimeofday (&t, 0);
+    return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+//
+// Press a key for one step, then release it for one step.
+//
+static void press_key (calc_t *c, int key)
+{
+    keycode = key;
+    calc_step (c);
+    keycode = 0;
+    calc_step (c);
+}
+
+//
+// Compare the state of two PLM chips.
+//
+static int plm_equal (plm_t *a, plm_t *b)
+{
+    return memcmp (a->R, b->R, sizeof(a->R)) == 0 &&
+           memcmp (a->ST, b->ST, sizeof(a->ST)) == 0 &&
+           memcmp (a->show_dot, b->show_dot, sizeof(a->show_dot)) == 0 &&
+           a->S == b->S && a->Q == b->Q && a->carry == b->carry &&
+           a->keypad_event == b->keypad_event && a->dot == b->dot &&
+           a->command == b->command &&
+           a->enable_display == b->enable_display;
+}
+
+//
+// Compare the state of two calculators.
+//
+static int calc_equal (calc_t *a, calc_t *b)
+{
+    return plm_equal (&a->ik1302, &b->ik1302) &&
+           plm_equal (&a->ik1303, &b->ik1303) &&
+#ifndef MK_54
+           plm_equal (&a->ik1306, &b->ik1306) &&
+#endif
+           memcmp (a->ring, b->ring, sizeof(a->ring)) == 0 &&
+           a->head == b->head;
+}
+
+//
+// Run the same program on a group of calculators in lockstep,
+// on SIMD lanes or on the bit-sliced engine.
+// Every lane gets its own input value: digit 1...9 in X register.
+// With a second program, odd lanes run it, so lanes diverge
+// from the first step.  With verify flag, compare every lane
+// with a scalar calculator.
+//
+static int bench_lanes (unsigned char code[], unsigned char code2[],
+    unsigned nsteps, int nlanes, int bitslice, int verify)
+{
+    static const unsigned char digit_key[9] = {
+        KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9,
+    };
+    simd_t *s = 0;
+    slice_t running = 0;
+    unsigned i;
+    int lane, errors = 0;
+    double t0, t1;
+
+    if (bitslice) {
+        nlanes = BSLICE_NLANES;
+        bslice_init (&bslice);
+    } else if (! (s = simd_create (nlanes))) {
+        fprintf (stderr, "Unsupported number of lanes: %d\n", nlanes);
+        return 1;
+    }
+    for (lane=0; lane<nlanes; lane++) {
+        calc_t *c = &lane_calc[lane];
+
+        calc_init (c, &callbacks, 0);
+        calc_warm_start (c, MODE_DEGREES);
+        calc_write_code (c, (code2 && (lane & 1)) ? code2 : code);
+        press_key (c, digit_key [lane % 9]);
+        press_key (c, KEY_RET);
+        press_key (c, KEY_STOPGO);
+        if (verify)
+            check_calc[lane] = *c;
+        if (s)
+            simd_load (s, lane, c);
+        else
+            bslice_load (&bslice, lane, c);
+    }
+
+    t0 = now();
+    for (i=0; i<nsteps; i++)
+        running = s ? simd_step (s) : bslice_step (&bslice);
+    t1 = now();
+
+    printf ("%u steps of %d lanes (%s) in %.3f seconds: %.0f machine-words/sec, %d running\n",
+        nsteps, nlanes, s ? s->engine : "bit-sliced", t1 - t0,
+        nsteps * 560.0 * nlanes / (t1 - t0),
+        __builtin_popcountll (running));
+
+    if (verify) {
+        for (lane=0; lane<nlanes; lane++) {
+            for (i=0; i<nsteps; i++)
+                calc_step (&check_calc[lane]);
+            if (s)
+                simd_store (s, lane, &lane_calc[lane]);
+            else
+                bslice_store (&bslice, lane, &lane_calc[lane]);
+            if (! calc_equal (&lane_calc[lane], &check_calc[lane])) {
+                printf ("Lane %d differs from scalar simulation.\n", lane);
+                errors++;
+            }
+        }
+        if (! errors)
+            printf ("All %d lanes match scalar simulation.\n", nlanes);
+    }
+    if (s)
+        simd_free (s);
+    return errors != 0;
+}
+
+//
+// Run the program on the instruction-level engine until it stops.
+//
+static int bench_hle (unsigned char code[])
+{
+    static hle_t h;
+    double t0, t1;
+    int status;
+
+    hle_init (&h, code);
+    t0 = now();
+    status = hle_run (&h, 1000000000);
+    t1 = now();
+
+    printf ("%llu instructions in %.3f seconds: %.0f instructions/sec%s\n",
+        h.count, t1 - t0, h.count / (t1 - t0),
+        (status == HLE_STOPPED) ? " (program stopped)" :
+        (status == HLE_UNSUPPORTED) ? " (unsupported instruction)" : "");
+    return status == HLE_UNSUPPORTED;
+}
+
+int main (int argc, char **argv)
+{
+    unsigned char code[CODE_NBYTES], code2[CODE_NBYTES];
+    unsigned nsteps = 2000, i;
+    int running = 0, reference = 0, nlanes = 0, bitslice = 0, verify = 0;
+    int hle = 0, opt;
+    char *diverge = 0;
+    double t0, t1;
+
+    while ((opt = getopt (argc, argv, "rl:bved:")) != -1) {
+        switch (opt) {
+        case 'r':   // Use per-cycle reference simulation.
+            reference = 1;
+            break;
+        case 'l':   // Run several calculators on SIMD lanes.
+            nlanes = strtol (optarg, 0, 0);
+            break;
+        case 'b':   // Run 64 calculators on the bit-sliced engine.
+            bitslice = 1;
+            break;
+        case 'v':   // Compare lanes with scalar simulation.
+            verify = 1;
+            break;
+        case 'e':   // Run on the instruction-level engine.
+            hle = 1;
+            break;
+        case 'd':   // Run another program on odd lanes.
+            diverge = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc > 1)
+        nsteps = strtoul (argv[1], 0, 0);
+    if (argc < 1 || nsteps == 0) {
+usage:  fprintf (stderr, "Usage:\n");
+        fprintf (stderr, "    bench [-r] [-l lanes | -b] [-v] [-d other.pmk] file.pmk [nsteps]\n");
+        fprintf (stderr, "    bench -e file.pmk\n");
+        return 1;
+    }
+    for (i=0; i<CODE_NBYTES; i++) {
+        code[i] = 0;
+        code2[i] = 0;
+    }
+    parse_prog (argv[0], code);
+    if (diverge)
+        parse_prog (diverge, code2);
+
+    if (hle)
+        return bench_hle (code);
+    if (nlanes > 0 || bitslice)
+        return bench_lanes (code, diverge ? code2 : 0, nsteps, nlanes,
+            bitslice, verify);
+
+    // Start the program: B/O, C/П.
+    calc_init (&calc, &callbacks, 0);
+    calc_set_reference (&calc, reference);
+    calc_warm_start (&calc, MODE_DEGREES);
+    calc_write_code (&calc, code);
+    press_key (&calc, KEY_RET);
+    press_key (&calc, KEY_STOPGO);
+
+    // Display and keypad are not needed while the program runs.
+    calc_set_headless (&calc, 1);
+    t0 = now();
+    for (i=0; i<nsteps; i++)
+        running = calc_step (&calc);
+    t1 = now();
+
+    printf ("%u steps in %.3f seconds: %.0f words/sec%s\n",
+        nsteps, t1 - t0, nsteps * 560.0 / (t1 - t0),
+        running ? "" : " (program stopped)");
+    return 0;
+}
@@ -0,0 +1,819 @@
+/*
+ * Compare the instruction-level engine with the microcode.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "calc.h"
+#include "hle.h"
+#include "hybrid.h"
+
+//
+// Random programs are built from instructions which the engine
+// supports, with operands which make the results exact.
+// Every program is run by the microcode and by the engine,
+// then stack and registers are compared.  When the engine
+// stops at an unsupported instruction, the instruction
+// is replaced by С/П and the program is run again.
+//
+#define MAXSTEPS    20000               // Time limit, in calc_step() units
+#define MAXINSNS    2000                // Limit of instructions
+
+unsigned keycode;
+unsigned rgd = MODE_DEGREES;
+calc_t calc;
+
+int verbose;
+unsigned long long seed = 1;
+
+static int calc_rgd (void *arg)
+{
+    return rgd;
+}
+
+static int calc_keypad (void *arg)
+{
+    return keycode;
+}
+
+static void calc_display (void *arg, int i, int digit, int dot)
+{
+}
+
+static const calc_callbacks_t callbacks = {
+    calc_display, calc_rgd, calc_keypad, 0,
+};
+
+//
+// Pseudo-random numbers: xorshift64.
+//
+static unsigned rnd (unsigned n)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (seed >> 11) % n;
+}
+
+//
+// Press a key for one step, then release it for one step.
+//
+static void press_key (calc_t *c, int key)
+{
+    keycode = key;
+    calc_step (c);
+    keycode = 0;
+    calc_step (c);
+}
+
+//
+// Run a program from address 0 until it stops.
+// Return the count of instructions, С/П included, or 0 on timeout.
+//
+static unsigned long run_program (calc_t *c, unsigned char code[])
+{
+    calc_run_t r;
+
+    calc_write_code (c, code);
+    press_key (c, KEY_RET);
+    r.keycode = KEY_STOPGO;
+    r.max_words = MAXSTEPS * (unsigned long) STEP_NWORDS;
+    r.max_insns = 0;
+    r.stable_words = 0;
+    if (calc_run (c, &r) != CALC_STOPPED)
+        return 0;
+    return r.insns;
+}
+
+//
+// Put the digits of a value to the code: mantissa as a string,
+// sign and decimal exponent.  With point flag, the decimal point
+// goes after the first digit.  Return the new length.
+//
+static int put_value (unsigned char *code, int n, const char *s,
+    int neg, int exp, int point)
+{
+    int i;
+
+    if (strcmp (s, "0") == 0) {
+        code[n++] = 0x0d;               // Cx
+        return n;
+    }
+    for (i=0; s[i]; i++) {
+        code[n++] = (s[i] == '.') ? 0x0a : s[i] - '0';
+        if (point && i == 0 && s[1])
+            code[n++] = 0x0a;
+    }
+    if (neg)
+        code[n++] = 0x0b;               // /-/
+    if (exp != 0) {
+        code[n++] = 0x0c;               // ВП
+        code[n++] = abs (exp) / 10;
+        code[n++] = abs (exp) % 10;
+        if (exp < 0)
+            code[n++] = 0x0b;           // /-/
+    }
+    return n;
+}
+
+//
+// Generate the input of a random value: mantissa of 1-8 digits,
+// random sign, and mostly small exponent.
+//
+static int gen_random_value (unsigned char *code, int n)
+{
+    char buf[32];
+    int ndigits, i;
+
+    ndigits = 1 + rnd (8);
+    for (i=0; i<ndigits; i++)
+        buf[i] = '0' + rnd (10);
+    buf[0] = '1' + rnd (9);
+    buf[ndigits] = 0;
+    i = rnd (2);
+    return put_value (code, n, buf, i,
+        rnd (3) ? (int) rnd (9) - 4 : (int) rnd (199) - 99, 1);
+}
+
+//
+// Generate the input of a value: random, or one of samples.
+// Return the new length of the code.
+//
+static int gen_value (unsigned char *code, int n)
+{
+    static const char *const samples[] = {
+        "0", "1", "2", "3", "5", "7", "8", "9", "10", "12", "15", "99",
+        "100", "0.5", "0.25", "2.5", "1.5", "0.1", "-1", "-2", "-3",
+        "-0.5", "-12", "3.75", "1e3", "2e-3", "1e7", "1e8",
+        "-4.5e2", "12345678", "99999999", "1e99", "1e-99",
+        "90", "-90", "100", "-100", "1e-3", "2.25", "6.25", "1.44e-2",
+    };
+    const char *s;
+    char buf[32];
+    int neg = 0, exp = 0, i;
+
+    if (rnd (4) == 0)
+        return gen_random_value (code, n);
+
+    s = samples [rnd (sizeof(samples) / sizeof(samples[0]))];
+    if (*s == '-') {
+        neg = 1;
+        s++;
+    }
+    for (i=0; s[i] && s[i] != 'e'; i++)
+        buf[i] = s[i];
+    buf[i] = 0;
+    if (s[i] == 'e')
+        exp = atoi (s + i + 1);
+    return put_value (code, n, buf, neg, exp, 0);
+}
+
+//
+// Set up a calculator with random values in registers and stack.
+//
+static void setup (calc_t *c)
+{
+    unsigned char code [CODE_NBYTES];
+    int n, i, r;
+
+    calc_init (c, &callbacks, 0);
+    calc_warm_start (c, rgd);
+    rgd = MODE_RADIANS + rnd (3);
+
+    // Registers, five at a time: value, П n.
+    for (r=0; r<DATA_NREGS; r+=5) {
+        memset (code, 0, sizeof(code));
+        n = 0;
+        for (i=r; i<r+5 && i<DATA_NREGS; i++) {
+            n = gen_value (code, n);
+            code[n++] = 0x40 + i;
+        }
+        code[n] = 0x50;
+        run_program (c, code);
+    }
+
+    // Stack: T, B^, Z, B^, Y, B^, X.
+    memset (code, 0, sizeof(code));
+    n = 0;
+    for (i=0; i<4; i++) {
+        n = gen_value (code, n);
+        if (i < 3)
+            code[n++] = 0x0e;
+    }
+    code[n] = 0x50;
+    run_program (c, code);
+}
+
+//
+// Generate a random program of supported instructions.
+// It starts with К НОП to finish the number entry.
+//
+static void gen_program (unsigned char code[])
+{
+    static const unsigned char ops[] = {
+        0x0b, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14,
+        0x20, 0x22, 0x23, 0x25, 0x31, 0x32, 0x34, 0x35, 0x54,
+        0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+        0x1e, 0x21, 0x21, 0x21,
+    };
+    static const unsigned char jumps[] = {
+        0x51, 0x53, 0x57, 0x58, 0x59, 0x5a, 0x5b, 0x5c, 0x5d, 0x5e,
+    };
+    int len = 2 + rnd (30), n, op;
+
+    memset (code, 0, CODE_NBYTES);
+    code[0] = 0x54;
+    for (n=1; n<len; ) {
+        switch (rnd (8)) {
+        case 0:                         // Digits or point
+            op = rnd (12);
+            code[n++] = (op > 10) ? 0x0a : op;
+            break;
+        case 1:
+        case 2:                         // Operations
+            code[n++] = ops [rnd (sizeof(ops))];
+            break;
+        case 3:                         // П n, ИП n
+            code[n++] = (rnd (2) ? 0x40 : 0x60) + rnd (DATA_NREGS);
+            break;
+        case 4:                         // Indirect: K x!=0 ... K x=0
+            code[n++] = (0x7 + rnd (8)) << 4 | rnd (DATA_NREGS);
+            break;
+        case 5:                         // Jumps
+            op = jumps [rnd (sizeof(jumps))];
+            code[n++] = op;
+            op = 1 + rnd (len + 1);
+            code[n++] = (op / 10) << 4 | (op % 10);
+            break;
+        case 6:                         // В/О, rarely
+            code[n++] = rnd (4) ? 0x54 : 0x52;
+            break;
+        default:                        // Memory
+            code[n++] = (rnd (2) ? 0x40 : 0x60) + rnd (4);
+            break;
+        }
+    }
+    code[n] = 0x50;
+}
+
+static void print_value (const char *name, const unsigned char v[6])
+{
+    int i;
+
+    printf (" %s=", name);
+    for (i=0; i<6; i++)
+        printf ("%02x", v[i]);
+}
+
+static void print_state (const char *title, unsigned char stack[5][6],
+    unsigned char regs[][6])
+{
+    static const char *const stack_name[5] = { "X1", "X", "Y", "Z", "T" };
+    static const char *const reg_name[15] = {
+        "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "R8", "R9",
+        "Ra", "Rb", "Rc", "Rd", "Re",
+    };
+    int i;
+
+    printf ("%-10s", title);
+    for (i=0; i<5; i++)
+        print_value (stack_name[i], stack[i]);
+    for (i=0; i<DATA_NREGS; i++)
+        print_value (reg_name[i], regs[i]);
+    printf ("\n");
+}
+
+//
+// Run the engine on a program, starting after К НОП
+// with the state of a calculator.
+//
+static int run_engine (hle_t *h, calc_t *init, unsigned char code[],
+    unsigned long long limit)
+{
+    hle_init (h, code);
+    calc_get_stack (init, h->stack);
+    calc_get_regs (init, h->regs);
+    h->rgd = rgd;
+    h->pc = 1;
+    return hle_run (h, limit);
+}
+
+//
+// Run a program on the microcode and compare with the engine.
+// Return 1 when equal, 0 when the microcode did not stop.
+// With print flag, show the difference.
+//
+static int compare (calc_t *init, unsigned char code[], hle_t *h, int print)
+{
+    unsigned char stack[5][6], regs[DATA_NREGS][6];
+    unsigned long ninsns;
+    int i, n;
+
+    calc = *init;
+    ninsns = run_program (&calc, code);
+    if (! ninsns)
+        return 0;
+    calc_get_stack (&calc, stack);
+    calc_get_regs (&calc, regs);
+    if (memcmp (stack, h->stack, sizeof(stack)) == 0 &&
+        memcmp (regs, h->regs, sizeof(regs)) == 0 &&
+        ninsns == h->count + 1)
+        return 1;
+    if (! print)
+        return -1;
+
+    printf ("Mismatch, program:");
+    for (n=CODE_NBYTES; n>0 && code[n-1] == 0; n--)
+        continue;
+    for (i=0; i<n; i++)
+        printf (" %02x", code[i]);
+    printf ("\n");
+    calc_get_stack (init, stack);
+    calc_get_regs (init, regs);
+    print_state ("Initial:", stack, regs);
+    calc_get_stack (&calc, stack);
+    calc_get_regs (&calc, regs);
+    print_state ("Microcode:", stack, regs);
+    print_state ("Engine:", h->stack, h->regs);
+    if (ninsns != h->count + 1)
+        printf ("Instructions: %lu microcode, %llu engine.\n",
+            ninsns - 1, h->count);
+    return -1;
+}
+
+//
+// Run one program on both engines.  Return 1 when compared,
+// 0 when skipped, -1 on mismatch.
+//
+static int check_program (calc_t *init, unsigned char code[],
+    unsigned long long *ninsns)
+{
+    static hle_t h;
+    unsigned char part [CODE_NBYTES];
+    unsigned long long count, i;
+    int status;
+
+    for (;;) {
+        status = run_engine (&h, init, code, MAXINSNS);
+        if (status != HLE_UNSUPPORTED || h.pc >= CODE_NBYTES ||
+            code[h.pc] == 0x50)
+            break;
+        if (verbose > 1)
+            printf ("Unsupported: %02x at %u\n", code[h.pc], h.pc);
+        code[h.pc] = 0x50;
+    }
+    if (status != HLE_STOPPED)
+        return 0;
+
+    status = compare (init, code, &h, 0);
+    if (status >= 0) {
+        *ninsns += h.count * status;
+        return status;
+    }
+
+    // Find the first instruction which makes a difference:
+    // stop the program after it.
+    count = h.count;
+    for (i=1; i<count; i++) {
+        run_engine (&h, init, code, i);
+        memcpy (part, code, CODE_NBYTES);
+        part[h.pc] = 0x50;
+        if (run_engine (&h, init, part, MAXINSNS) == HLE_STOPPED &&
+            h.count == i + 1 && compare (init, part, &h, 0) < 0)
+            break;
+    }
+    if (i < count) {
+        run_engine (&h, init, code, i - 1);
+        printf ("First difference at address %u, instruction %02x.\n",
+            h.pc, code[h.pc]);
+        if (verbose) {
+            // Show the path of the engine.
+            run_engine (&h, init, part, 0);
+            printf ("Path:");
+            do
+                printf (" %u:%02x", h.pc, part[h.pc]);
+            while (hle_run (&h, 1) == HLE_LIMIT);
+            printf ("\n");
+        }
+        run_engine (&h, init, part, MAXINSNS);
+        compare (init, part, &h, 1);
+    } else {
+        run_engine (&h, init, code, MAXINSNS);
+        compare (init, code, &h, 1);
+    }
+    return -1;
+}
+
+//
+// Stop a program at a breakpoint, on the path of the engine,
+// by calc_step() or by calc_run().  The address and the return
+// stack must be the same as by the engine.  Then the program must
+// finish as without the breakpoint.  Return -1 on mismatch.
+//
+static int check_break (calc_t *init, unsigned char code[])
+{
+    static hle_t h, path;
+    unsigned char stack[5][6], regs[DATA_NREGS][6];
+    unsigned rstack [CALC_NRETURN];
+    unsigned addr, i;
+    calc_run_t r;
+    int by_step = rnd (2);
+
+    // Pick an instruction, and find its first execution.
+    run_engine (&h, init, code, MAXINSNS);
+    run_engine (&path, init, code, rnd (h.count));
+    addr = path.pc;
+    run_engine (&path, init, code, 0);
+    while (path.pc != addr)
+        hle_run (&path, 1);
+
+    calc = *init;
+    calc_write_code (&calc, code);
+    press_key (&calc, KEY_RET);
+    calc_set_break (&calc, addr, 1);
+    if (by_step) {
+        keycode = KEY_STOPGO;
+        calc_step (&calc);
+        keycode = 0;
+        for (i=0; i<MAXSTEPS && calc_get_break (&calc) < 0; i++)
+            calc_step (&calc);
+    } else {
+        r.keycode = KEY_STOPGO;
+        r.max_words = MAXSTEPS * (unsigned long) STEP_NWORDS;
+        r.max_insns = 0;
+        r.stable_words = 0;
+        calc_run (&calc, &r);
+    }
+    calc_get_rstack (&calc, rstack);
+    for (i=0; i<CALC_NRETURN; i++)
+        if (rstack[i] != path.rstack[i])
+            break;
+    if (calc_get_break (&calc) != addr || calc_get_pc (&calc) != addr ||
+        i < CALC_NRETURN) {
+        printf ("Breakpoint at %u by %s: stopped at %d, pc %u",
+            addr, by_step ? "calc_step" : "calc_run",
+            calc_get_break (&calc), calc_get_pc (&calc));
+        for (i=0; i<CALC_NRETURN; i++)
+            printf (" %u/%u", rstack[i], path.rstack[i]);
+        printf ("\n");
+        return -1;
+    }
+
+    // Continue to the end.
+    calc_set_break (&calc, addr, 0);
+    r.keycode = 0;
+    r.max_words = MAXSTEPS * (unsigned long) STEP_NWORDS;
+    r.max_insns = 0;
+    r.stable_words = 0;
+    if (calc_run (&calc, &r) != CALC_STOPPED) {
+        printf ("Breakpoint at %u: program does not stop\n", addr);
+        return -1;
+    }
+    calc_get_stack (&calc, stack);
+    calc_get_regs (&calc, regs);
+    if (memcmp (stack, h.stack, sizeof(stack)) != 0 ||
+        memcmp (regs, h.regs, sizeof(regs)) != 0) {
+        printf ("Breakpoint at %u: results differ\n", addr);
+        return -1;
+    }
+    return 1;
+}
+
+//
+// Stop a program at a breakpoint on a jump, before its address
+// is fetched, then stop it by С/П.  Press keys in manual mode,
+// and run the program again from the start: it must run
+// as by the engine from the new state.  Return -1 on mismatch.
+//
+static int check_restart (calc_t *init, unsigned char code[])
+{
+    static hle_t h;
+    static calc_t stopped;
+    static const int keys[] = { KEY_NEXT, KEY_NEXT, KEY_PREV, KEY_CLEAR };
+    unsigned addr, i;
+    calc_run_t r;
+    int status;
+
+    // Find the first jump on the path of the engine.
+    run_engine (&h, init, code, 0);
+    do {
+        addr = h.pc;
+        if (INSN_FETCHES_TWICE (code[addr]))
+            break;
+    } while (hle_run (&h, 1) == HLE_LIMIT);
+    if (! INSN_FETCHES_TWICE (code[addr]))
+        return 1;
+
+    calc = *init;
+    calc_write_code (&calc, code);
+    press_key (&calc, KEY_RET);
+    calc_set_break (&calc, addr, 1);
+    r.keycode = KEY_STOPGO;
+    r.max_words = MAXSTEPS * (unsigned long) STEP_NWORDS;
+    r.max_insns = 0;
+    r.stable_words = 0;
+    status = calc_run (&calc, &r);
+    calc_set_break (&calc, addr, 0);
+    if (status != CALC_BREAK || calc_get_pc (&calc) != addr) {
+        printf ("Restart: no stop at jump %u, pc %u\n",
+            addr, calc_get_pc (&calc));
+        return -1;
+    }
+
+    // When the program stops by itself while the key is pressed,
+    // the key starts it again, at the next address: skip it.
+    press_key (&calc, KEY_STOPGO);
+    r.keycode = 0;
+    if (calc_run (&calc, &r) != CALC_STOPPED)
+        return 1;
+    for (i=0; i<sizeof(keys)/sizeof(keys[0]); i++)
+        press_key (&calc, keys[i]);
+
+    stopped = calc;
+    if (run_engine (&h, &stopped, code, MAXINSNS) != HLE_STOPPED)
+        return 1;
+    if (compare (&stopped, code, &h, 1) < 0) {
+        printf ("Restart after a stop at jump %u\n", addr);
+        return -1;
+    }
+    return 1;
+}
+
+//
+// Watch a memory register, and run a program to the end.
+// Every stop on the watchpoint must happen after the same
+// instruction as by the engine.  Return -1 on mismatch.
+//
+static int check_watch (calc_t *init, unsigned char code[])
+{
+    static hle_t h;
+    unsigned char last [6];
+    unsigned fires [MAXINSNS], nfires = 0, pc, i;
+    calc_watch_t w, bad;
+    calc_run_t r;
+    int by_step = rnd (2), status;
+
+    w.reg = rnd (4) ? rnd (4) : rnd (DATA_NREGS);
+    w.cond = rnd (3);
+
+    // Find instructions which change the register.
+    run_engine (&h, init, code, 0);
+    memcpy (last, h.regs[w.reg], 6);
+    do {
+        pc = h.pc;
+        status = hle_run (&h, 1);
+        if (memcmp (last, h.regs[w.reg], 6) == 0)
+            continue;
+        memcpy (last, h.regs[w.reg], 6);
+        if ((w.cond == CALC_WATCH_NEG && (last[1] >> 4) != 9) ||
+            (w.cond == CALC_WATCH_ZERO && (last[2] | last[3] | last[4] | last[5])))
+            continue;
+        fires[nfires++] = pc;
+    } while (status == HLE_LIMIT && nfires < MAXINSNS);
+
+    calc = *init;
+    calc_write_code (&calc, code);
+    press_key (&calc, KEY_RET);
+    bad = w;
+    bad.reg = DATA_NREGS + rnd (CALC_WATCH_X1 - DATA_NREGS);
+    if (calc_set_watches (&calc, &bad, 1)) {
+        printf ("Watch of register %d accepted\n", bad.reg);
+        return -1;
+    }
+    if (! calc_set_watches (&calc, &w, 1)) {
+        printf ("Watch of register %d rejected\n", w.reg);
+        return -1;
+    }
+    r.keycode = KEY_STOPGO;
+    r.max_words = MAXSTEPS * (unsigned long) STEP_NWORDS;
+    r.max_insns = 0;
+    r.stable_words = 0;
+    if (by_step) {
+        keycode = KEY_STOPGO;
+        calc_step (&calc);
+        keycode = 0;
+    }
+    for (i=0; ; i++) {
+        if (by_step) {
+            while (calc_step (&calc) && calc_get_watch (&calc) < 0)
+                continue;
+            status = (calc_get_watch (&calc) < 0) ? CALC_STOPPED : CALC_WATCH;
+        } else {
+            status = calc_run (&calc, &r);
+            r.keycode = 0;
+        }
+        if (status != CALC_WATCH)
+            break;
+        if (i >= nfires || w.pc != fires[i] || ! w.fired)
+            break;
+        w.fired = 0;
+    }
+    calc_set_watches (&calc, 0, 0);
+    if (status != CALC_STOPPED || i != nfires) {
+        printf ("Watch of register %d, condition %d by %s: ",
+            w.reg, w.cond, by_step ? "calc_step" : "calc_run");
+        if (status == CALC_WATCH)
+            printf ("fired after %u, ", w.pc);
+        printf ("expected");
+        for (i=0; i<nfires; i++)
+            printf (" %u", fires[i]);
+        printf ("\n");
+        return -1;
+    }
+    return 1;
+}
+
+//
+// Compare functions of X on random arguments, not biased to special
+// values.  Count arguments which the engine computes, and square roots
+// among them.  Return the number of mismatches.
+//
+static unsigned check_functions (unsigned count, unsigned *ncomputed,
+    unsigned *nsqrt)
+{
+    static const unsigned char ops[] = {
+        0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x21,
+    };
+    static calc_t init;
+    unsigned char code [CODE_NBYTES], stack[5][6], result[6];
+    unsigned long long ninsns = 0;
+    unsigned i, op, errors = 0;
+    int n;
+
+    for (i=0; i<count; i++) {
+        if (i % 100 == 0)
+            setup (&init);
+
+        // Enter the argument.
+        calc = init;
+        memset (code, 0, sizeof(code));
+        n = gen_random_value (code, 0);
+        code[n] = 0x50;
+        if (! run_program (&calc, code))
+            continue;
+        calc_get_stack (&calc, stack);
+        op = ops [rnd (sizeof(ops))];
+        if (! hle_exact_function (op, stack[1], rgd, result))
+            continue;
+        if (op == 0x21)
+            (*nsqrt)++;
+
+        // Run К НОП, function, С/П.
+        memset (code, 0, sizeof(code));
+        code[0] = 0x54;
+        code[1] = op;
+        code[2] = 0x50;
+        init = calc;
+        (*ncomputed)++;
+        if (check_program (&init, code, &ninsns) < 0)
+            errors++;
+    }
+    return errors;
+}
+
+//
+// Run random programs by the microcode, and by the hybrid of
+// the microcode and the engine: all instructions are kept,
+// including unsupported ones.  Return the number of mismatches.
+//
+static unsigned check_hybrid (unsigned count, hybrid_t *h)
+{
+    static calc_t init, hybrid;
+    unsigned char code [CODE_NBYTES];
+    unsigned char stack[5][6], regs[DATA_NREGS][6];
+    unsigned char hstack[5][6], hregs[DATA_NREGS][6];
+    unsigned i, errors = 0;
+    int n, j;
+    unsigned long stopped;
+
+    for (i=0; i<count; i++) {
+        if (i % 50 == 0)
+            setup (&init);
+        gen_program (code);
+
+        // Skip programs which do not stop.
+        hybrid = init;
+        calc_write_code (&hybrid, code);
+        press_key (&hybrid, KEY_RET);
+        if (hybrid_run (h, &hybrid, MAXINSNS) != 0)
+            continue;
+        calc_get_stack (&hybrid, hstack);
+        calc_get_regs (&hybrid, hregs);
+
+        calc = init;
+        stopped = run_program (&calc, code);
+        calc_get_stack (&calc, stack);
+        calc_get_regs (&calc, regs);
+        if (stopped && memcmp (stack, hstack, sizeof(stack)) == 0 &&
+            memcmp (regs, hregs, sizeof(regs)) == 0)
+            continue;
+        errors++;
+        printf ("Hybrid mismatch, program:");
+        for (n=CODE_NBYTES; n>0 && code[n-1] == 0; n--)
+            continue;
+        for (j=0; j<n; j++)
+            printf (" %02x", code[j]);
+        printf ("\n");
+        calc_get_stack (&init, hstack);
+        calc_get_regs (&init, hregs);
+        print_state ("Initial:", hstack, hregs);
+        print_state ("Microcode:", stack, regs);
+        calc_get_stack (&hybrid, hstack);
+        calc_get_regs (&hybrid, hregs);
+        print_state ("Hybrid:", hstack, hregs);
+    }
+    return errors;
+}
+
+int main (int argc, char **argv)
+{
+    static calc_t init;
+    unsigned char code [CODE_NBYTES];
+    unsigned long long ninsns = 0;
+    static hybrid_t hybrid;
+    unsigned ntests = 200, nsetups = 20, nfuncs = 0, nhybrid = 0, i;
+    unsigned compared = 0, skipped = 0, errors = 0, computed = 0, nsqrt = 0;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "n:s:f:y:v")) != -1) {
+        switch (opt) {
+        case 'n':   // Number of programs.
+            ntests = strtoul (optarg, 0, 0);
+            break;
+        case 'f':   // Number of function arguments.
+            nfuncs = strtoul (optarg, 0, 0);
+            break;
+        case 'y':   // Number of programs for the hybrid.
+            nhybrid = strtoul (optarg, 0, 0);
+            break;
+        case 's':   // Random seed.
+            seed = strtoull (optarg, 0, 0);
+            break;
+        case 'v':   // Verbose.
+            verbose++;
+            break;
+        default:
+            fprintf (stderr, "Usage:\n");
+            fprintf (stderr, "    hletest [-v] [-n count] [-f count] [-y count] [-s seed]\n");
+            return 1;
+        }
+    }
+
+    for (i=0; i<ntests; i++) {
+        if (i % (ntests / nsetups + 1) == 0)
+            setup (&init);
+        gen_program (code);
+        switch (check_program (&init, code, &ninsns)) {
+        case 1:
+            compared++;
+            if (check_break (&init, code) < 0 ||
+                check_restart (&init, code) < 0 ||
+                check_watch (&init, code) < 0)
+                errors++;
+            break;
+        case 0:  skipped++;  break;
+        default: errors++;   break;
+        }
+    }
+    printf ("%u programs, %llu instructions compared, %u skipped, %u mismatches.\n",
+        compared, ninsns, skipped, errors);
+    if (nfuncs > 0) {
+        i = check_functions (nfuncs, &computed, &nsqrt);
+        printf ("%u function arguments, %u computed natively (%u square roots), %u mismatches.\n",
+            nfuncs, computed, nsqrt, i);
+        errors += i;
+    }
+    if (nhybrid > 0) {
+        hybrid_init (&hybrid);
+        i = check_hybrid (nhybrid, &hybrid);
+        printf ("%u hybrid programs, %llu instructions by engine, %llu by microcode, %u mismatches.\n",
+            nhybrid, hybrid.native, hybrid.simulated, i);
+        errors += i;
+    }
+    if (errors)
+        return 1;
+    printf ("Engine test PASSED.\n");
+    return 0;
+}
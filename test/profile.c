@@ -0,0 +1,234 @@
+/*
+ * Profile of MK-61 microcode: run a program, and count commands
+ * and micro-instructions of every chip, and words spent by every
+ * user instruction.  Needs the simulator built with -DPLM_PROFILE.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "calc.h"
+
+#ifndef PLM_PROFILE
+#error Build with -DPLM_PROFILE
+#endif
+
+extern int parse_prog (char *filename, unsigned char prog[]);
+
+calc_t calc;
+
+//
+// Chips of the calculator, in order of the ring.
+//
+static struct {
+    const char *name;
+    plm_t *plm;
+} chips [] = {
+    { "ik1302", &calc.ik1302 },
+    { "ik1303", &calc.ik1303 },
+#ifndef MK_54
+    { "ik1306", &calc.ik1306 },
+#endif
+};
+
+#define NCHIPS (sizeof(chips) / sizeof(chips[0]))
+
+//
+// Counters to sort by.
+//
+static const unsigned long *sort_count;
+
+//
+// Compare indices by counters, largest first, then by index.
+//
+static int by_count (const void *a, const void *b)
+{
+    unsigned i = *(const unsigned*) a;
+    unsigned k = *(const unsigned*) b;
+
+    if (sort_count[i] != sort_count[k])
+        return (sort_count[i] < sort_count[k]) ? 1 : -1;
+    return (i < k) ? -1 : 1;
+}
+
+//
+// Get indices of nonzero counters, sorted.
+// Return the number of them, and the total.
+//
+static unsigned sort_counters (const unsigned long count[], unsigned n,
+    unsigned index[], unsigned long *total)
+{
+    unsigned i, nz = 0;
+
+    *total = 0;
+    for (i=0; i<n; i++) {
+        if (count[i] == 0)
+            continue;
+        *total += count[i];
+        index[nz++] = i;
+    }
+    sort_count = count;
+    qsort (index, nz, sizeof(index[0]), by_count);
+    return nz;
+}
+
+//
+// Print counters of a chip, sorted: commands by address
+// in command ROM, or micro-instructions.
+//
+static void report_chip (const char *title, const char *name,
+    const unsigned long count[], unsigned n)
+{
+    unsigned index [PLM_NCMDS], nz, i;
+    unsigned long total;
+
+    nz = sort_counters (count, n, index, &total);
+    printf ("\n%s of %s: %lu executed, %u different.\n", title, name, total, nz);
+    printf ("Address        Count  Percent\n");
+    for (i=0; i<nz; i++)
+        printf ("     %02x %12lu %7.2f%%\n", index[i], count[index[i]],
+            count[index[i]] * 100.0 / total);
+}
+
+//
+// Print words of user instructions, sorted by the total cost.
+//
+static void report_insns (calc_profile_t *p)
+{
+    unsigned index [256], nz, i, op;
+    unsigned long total, ninsns = 0;
+
+    nz = sort_counters (p->words, 256, index, &total);
+    for (i=0; i<nz; i++)
+        ninsns += p->count[index[i]];
+    printf ("User instructions: %lu executed, %lu words.\n", ninsns, total);
+    printf ("Opcode        Count        Words  Words/insn  Percent\n");
+    for (i=0; i<nz; i++) {
+        op = index[i];
+        printf ("    %02x %12lu %12lu %11.1f %7.2f%%\n", op, p->count[op],
+            p->words[op], (double) p->words[op] / p->count[op],
+            p->words[op] * 100.0 / total);
+    }
+}
+
+//
+// Write all nonzero counters, one per line:
+//      insn <opcode> <count> <words>
+//      cmd <chip> <address> <count>
+//      ucmd <chip> <address> <count>
+// Opcodes and addresses are in hex.
+//
+static int write_profile (const char *filename)
+{
+    calc_profile_t *p = &calc.profile;
+    FILE *fd;
+    unsigned k, i;
+
+    fd = fopen (filename, "w");
+    if (! fd) {
+        perror (filename);
+        return 0;
+    }
+    for (i=0; i<256; i++) {
+        if (p->count[i] != 0)
+            fprintf (fd, "insn %02x %lu %lu\n", i, p->count[i], p->words[i]);
+    }
+    for (k=0; k<NCHIPS; k++) {
+        for (i=0; i<PLM_NCMDS; i++) {
+            if (chips[k].plm->cmd_count[i] != 0)
+                fprintf (fd, "cmd %s %02x %lu\n", chips[k].name, i,
+                    chips[k].plm->cmd_count[i]);
+        }
+        for (i=0; i<PLM_NUCMDS; i++) {
+            if (chips[k].plm->ucmd_count[i] != 0)
+                fprintf (fd, "ucmd %s %02x %lu\n", chips[k].name, i,
+                    chips[k].plm->ucmd_count[i]);
+        }
+    }
+    fclose (fd);
+    return 1;
+}
+
+int main (int argc, char **argv)
+{
+    unsigned char code[CODE_NBYTES];
+    unsigned nsteps = 2000, i;
+    int reference = 0, status, opt;
+    char *output = 0;
+    calc_run_t r;
+
+    while ((opt = getopt (argc, argv, "ro:")) != -1) {
+        switch (opt) {
+        case 'r':   // Use per-cycle reference simulation.
+            reference = 1;
+            break;
+        case 'o':   // Write counters to a file.
+            output = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc > 1)
+        nsteps = strtoul (argv[1], 0, 0);
+    if (argc < 1 || nsteps == 0) {
+usage:  fprintf (stderr, "Usage:\n");
+        fprintf (stderr, "    profile [-r] [-o file] file.pmk [nsteps]\n");
+        return 1;
+    }
+    for (i=0; i<CODE_NBYTES; i++)
+        code[i] = 0;
+    parse_prog (argv[0], code);
+
+    // Go to the start of the program with B/O, then count
+    // the run from C/П until it stops, or for a given number of steps.
+    calc_init (&calc, 0, 0);
+    calc_set_headless (&calc, 1);
+    calc_set_reference (&calc, reference);
+    calc_warm_start (&calc, MODE_DEGREES);
+    calc_write_code (&calc, code);
+    calc_press_key (&calc, KEY_RET, STEP_NWORDS * 100);
+    calc_profile_clear (&calc);
+
+    r.keycode = KEY_STOPGO;
+    r.max_words = (unsigned long) nsteps * STEP_NWORDS;
+    r.max_insns = 0;
+    r.stable_words = 0;
+    status = calc_run (&calc, &r);
+    printf ("%lu words, %lu instructions%s.\n\n", r.words, r.insns,
+        (status == CALC_STOPPED) ? " (program stopped)" : "");
+
+    report_insns (&calc.profile);
+    for (i=0; i<NCHIPS; i++) {
+        report_chip ("Commands", chips[i].name,
+            chips[i].plm->cmd_count, PLM_NCMDS);
+        report_chip ("Micro-instructions", chips[i].name,
+            chips[i].plm->ucmd_count, PLM_NUCMDS);
+    }
+    if (output && ! write_profile (output))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ * Run a list of MK-61 jobs in parallel.
+ *
+ * Every line of the job file describes one job: a program file,
+ * followed by optional initial values and a key script:
+ *
+ *      programs/fact.pmk X=5
+ *      programs/fib.pmk Y=1 X=1 keys=B/O,C/П
+ *
+ * Values are set by X=, Y=, Z=, T= and R0= ... RE=.  By default
+ * the program is started by B/O, C/П.  For every job, the result
+ * stack, registers and display are printed on a separate line.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "batch.h"
+
+extern int parse_prog (char *filename, unsigned char prog[]);
+
+//
+// Names of keys for the key script.
+//
+static const struct {
+    const char *name;
+    unsigned char code;
+} key_names[] = {
+    { "0",    KEY_0 },      { "1",    KEY_1 },      { "2",    KEY_2 },
+    { "3",    KEY_3 },      { "4",    KEY_4 },      { "5",    KEY_5 },
+    { "6",    KEY_6 },      { "7",    KEY_7 },      { "8",    KEY_8 },
+    { "9",    KEY_9 },      { "+",    KEY_ADD },    { "-",    KEY_SUB },
+    { "*",    KEY_MUL },    { "/",    KEY_DIV },    { "<->",  KEY_XY },
+    { ".",    KEY_DOT },    { "/-/",  KEY_NEG },    { "ВП",   KEY_EXP },
+    { "Cx",   KEY_CLEAR },  { "B^",   KEY_ENTER },  { "C/П",  KEY_STOPGO },
+    { "БП",   KEY_GOTO },   { "B/O",  KEY_RET },    { "ПП",   KEY_CALL },
+    { "П",    KEY_STORE },  { "ШГ>",  KEY_NEXT },   { "ИП",   KEY_LOAD },
+    { "<ШГ",  KEY_PREV },   { "K",    KEY_K },      { "F",    KEY_F },
+    { "RAD",  MODE_RADIANS }, { "DEG", MODE_DEGREES }, { "GRD", MODE_GRADS },
+    { 0 },
+};
+
+static const char *stack_name[5] = { "X1", "X", "Y", "Z", "T" };
+
+int quiet;
+
+//
+// Parse a key script like "B/O,C/П".
+//
+static int parse_keys (const char *str, unsigned char *keys)
+{
+    char buf [256], *name, *last;
+    int n = 0, i;
+
+    strncpy (buf, str, sizeof(buf) - 1);
+    buf [sizeof(buf) - 1] = 0;
+    // Parse_job() is in the middle of strtok() on the job line.
+    for (name=strtok_r (buf, ",", &last); name; name=strtok_r (0, ",", &last)) {
+        for (i=0; key_names[i].name; i++)
+            if (strcmp (name, key_names[i].name) == 0)
+                break;
+        if (! key_names[i].name || n >= BATCH_NKEYS - 3)
+            return 0;
+        keys[n++] = key_names[i].code;
+        if (key_names[i].code >= 16)
+            keys[n++] = 0;
+    }
+    keys[n] = 0xff;
+    return 1;
+}
+
+//
+// Parse one line of the job file.
+//
+static int parse_job (char *line, batch_job_t *job)
+{
+    static char last_file [256];
+    static unsigned char last_code [CODE_NBYTES];
+    char *word = strtok (line, " \t\r\n");
+    int i;
+
+    if (! word || word[0] == '#')
+        return 0;
+
+    // Program: parse the file only when it changes.
+    if (strcmp (word, last_file) != 0) {
+        memset (last_code, 0, sizeof(last_code));
+        parse_prog (word, last_code);
+        strncpy (last_file, word, sizeof(last_file) - 1);
+    }
+    memcpy (job->code, last_code, sizeof(job->code));
+    parse_keys ("B/O,C/П", job->keys);
+
+    while ((word = strtok (0, " \t\r\n")) != 0) {
+        if (strncmp (word, "keys=", 5) == 0) {
+            if (! parse_keys (word + 5, job->keys))
+                goto error;
+            continue;
+        }
+        for (i=1; i<5; i++) {
+            int len = strlen (stack_name[i]);
+            if (strncmp (word, stack_name[i], len) == 0 && word[len] == '=') {
+                if (! batch_parse_value (word + len + 1, job->stack[i-1]))
+                    goto error;
+                job->stack_mask |= 1 << (i-1);
+                break;
+            }
+        }
+        if (i < 5)
+            continue;
+        if (word[0] == 'R' && word[1] && word[2] == '=') {
+            const char *p = strchr ("0123456789ABCDE", word[1]);
+            i = p ? p - "0123456789ABCDE" : DATA_NREGS;
+            if (i >= DATA_NREGS ||
+                ! batch_parse_value (word + 3, job->regs[i]))
+                goto error;
+            job->regs_mask |= 1 << i;
+            continue;
+        }
+error:  fprintf (stderr, "Bad job parameter: %s\n", word);
+        exit (1);
+    }
+    return 1;
+}
+
+//
+// Print the result of a job.
+//
+static void print_result (batch_job_t *job, void *arg)
+{
+    char buf [16];
+    int i;
+
+    if (quiet)
+        return;
+    printf ("%lu %s steps=%u", (unsigned long) job->arg,
+        job->status == BATCH_STOPPED ? "stopped" : "timeout", job->steps);
+    for (i=1; i<5; i++) {
+        batch_format_value (buf, job->result_stack[i]);
+        printf (" %s=%s", stack_name[i], buf);
+    }
+    batch_format_value (buf, job->result_stack[0]);
+    printf (" X1=%s", buf);
+    for (i=0; i<DATA_NREGS; i++) {
+        batch_format_value (buf, job->result_regs[i]);
+        printf (" R%c=%s", "0123456789ABCDE"[i], buf);
+    }
+    printf (" display='");
+    for (i=0; i<12; i++) {
+        putchar ("0123456789-LCRE " [job->display[11-i]]);
+        if (job->show_dot[11-i])
+            putchar ('.');
+    }
+    printf ("'\n");
+    fflush (stdout);
+}
+
+//
+// Check conversions of numbers to the calculator format and back:
+// special cases, and a round trip of random values.
+// Return the number of errors.
+//
+static int check_conversions (unsigned count)
+{
+    static const struct {
+        double d;                       // Number
+        const char *text;               // Expected value, or 0 if rejected
+    } tests[] = {
+        { 0.0,              " 0.0000000e+00" },
+        { -0.0,             " 0.0000000e+00" },
+        { 1e-99,            " 1.0000000e-99" },
+        { -1e-99,           "-1.0000000e-99" },
+        { 9.9999999e99,     " 9.9999999e+99" },
+        { 5e-100,           " 0.0000000e+00" },
+        { 1.234567851,      " 1.2345679e+00" },
+        { -1.234567849,     "-1.2345678e+00" },
+        { 9.99999996,       " 1.0000000e+01" },
+        { 9.99999996e99,    0 },
+        { 1e100,            0 },
+        { NAN,              0 },
+        { INFINITY,         0 },
+        { -INFINITY,        0 },
+    };
+    static const unsigned char hex[6] = { 0, 0, 0x0a, 0, 0, 0 };
+    unsigned char value[6], back[6];
+    char buf[32], text[32];
+    unsigned i;
+    int errors = 0, ok;
+
+    for (i=0; i<sizeof(tests)/sizeof(tests[0]); i++) {
+        ok = batch_value_from_double (tests[i].d, value);
+        if (ok)
+            batch_format_value (buf, value);
+        if (tests[i].text ? (! ok || strcmp (buf, tests[i].text) != 0) : ok) {
+            printf ("Conversion of %.10g: got '%s', expected '%s'\n",
+                tests[i].d, ok ? buf : "error",
+                tests[i].text ? tests[i].text : "error");
+            errors++;
+        }
+    }
+    if (batch_parse_value ("-0", value) && batch_value_to_double (value) != 0) {
+        printf ("Conversion of -0 to a number: not zero\n");
+        errors++;
+    }
+    if (! isnan (batch_value_to_double (hex))) {
+        printf ("Conversion of a hex mantissa: not NaN\n");
+        errors++;
+    }
+
+    // Every value of the calculator must survive the round trip.
+    for (i=0; i<count; i++) {
+        sprintf (text, "%s%d.%07ue%d", (rand() & 1) ? "-" : "",
+            1 + rand() % 9, (unsigned) rand() % 10000000,
+            rand() % 199 - 99);
+        if (! batch_parse_value (text, value) ||
+            ! batch_value_from_double (batch_value_to_double (value), back) ||
+            memcmp (value, back, 6) != 0) {
+            batch_format_value (buf, back);
+            printf ("Round trip of %s: got '%s'\n", text, buf);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+//
+// Get current time in seconds.
+//
+static double now()
+{
+    struct timeval t;
+
+    gettimeofday (&t, 0);
+    return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+int main (int argc, char **argv)
+{
+    batch_job_t *jobs = 0;
+    unsigned njobs = 0, nlines = 0, max_steps = 100000, repeat = 1, i;
+    int nthreads = 0, opt;
+    char line [1024];
+    double t0, t1;
+    FILE *fd;
+
+    while ((opt = getopt (argc, argv, "j:n:s:qc")) != -1) {
+        switch (opt) {
+        case 'c':
+            // Check conversions of numbers, and exit.
+            if (check_conversions (100000) != 0)
+                return 1;
+            printf ("Conversion test PASSED.\n");
+            return 0;
+        case 'j': nthreads = strtol (optarg, 0, 0); break;
+        case 'n': repeat = strtoul (optarg, 0, 0);  break;
+        case 's': max_steps = strtoul (optarg, 0, 0); break;
+        case 'q': quiet = 1;                        break;
+        default:  goto usage;
+        }
+    }
+    if (optind != argc - 1) {
+usage:  fprintf (stderr, "Usage:\n");
+        fprintf (stderr, "    runjobs [-j threads] [-n repeat] [-s maxsteps] [-q] jobfile\n");
+        fprintf (stderr, "    runjobs -c\n");
+        return 1;
+    }
+    fd = fopen (argv[optind], "r");
+    if (! fd) {
+        perror (argv[optind]);
+        return 1;
+    }
+    while (fgets (line, sizeof(line), fd)) {
+        jobs = realloc (jobs, (nlines + 1) * sizeof(batch_job_t));
+        memset (&jobs[nlines], 0, sizeof(batch_job_t));
+        if (parse_job (line, &jobs[nlines]))
+            nlines++;
+    }
+    fclose (fd);
+
+    // Repeat the list of jobs.
+    njobs = nlines * repeat;
+    jobs = realloc (jobs, njobs * sizeof(batch_job_t));
+    for (i=0; i<njobs; i++) {
+        if (i >= nlines)
+            jobs[i] = jobs[i % nlines];
+        jobs[i].max_steps = max_steps;
+        jobs[i].arg = (void*) (unsigned long) i;
+    }
+
+    t0 = now();
+    nthreads = batch_run (jobs, njobs, nthreads, print_result, 0);
+    t1 = now();
+    fprintf (stderr, "%u jobs on %d threads in %.3f seconds: %.1f jobs/sec\n",
+        njobs, nthreads, t1 - t0, njobs / (t1 - t0));
+    free (jobs);
+    return 0;
+}
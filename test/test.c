@@ -22,6 +22,7 @@
  * this software.
  */
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "calc.h"
@@ -170,48 +171,111 @@ unsigned rad_grad_deg = MODE_DEGREES;   // Switch radians/grads/degrees
 
 unsigned keycode = 0;
 
+calc_t calc;
+
 //
-// Show the next display symbol.
-// Index counter is in range 0..11.
+// Get the display, when changed.
 //
-void calc_display (int i, int digit, int dot)
+static void calc_frame (void *arg, const unsigned char digit[12],
+    const unsigned char dot[12])
 {
-    if (i >= 0) {
-        if (digit >= 0) {
-            if (digit != display[i] || dot != show_dot[i]) {
-                display[i] = digit;
-                show_dot[i] = dot;
-                display_changed = 1;
-            }
-        }
-    }
+    memcpy (display, digit, sizeof (display));
+    memcpy (show_dot, dot, sizeof (show_dot));
+    display_changed = 1;
 }
 
+static const calc_callbacks_t callbacks = {
+    0, 0, 0, 0, calc_frame,
+};
+
 //
-// Poll the radians/grads/degrees switch.
+// Debug trace: print the display in run mode,
+// once per 14 words.
 //
-int calc_rgd()
+static void calc_trace (void *arg, unsigned k)
 {
-    return rad_grad_deg;
+    int i, digit, dot;
+
+    if (calc.ik1302.dot != 11 || k%14 != 0)
+        return;
+    printf ("             %-2u '", k/14);
+    for (i=11; i>=0; i--) {
+        if (i < 3) {
+            // Exponent.
+            digit = calc.ik1302.R [(i + 9) * 3];
+            dot = calc.ik1302.show_dot [i + 10];
+        } else {
+            // Mantissa.
+            digit = calc.ik1302.R [(i - 3) * 3];
+            dot = calc.ik1302.show_dot [i - 2];
+        }
+        putchar ("0123456789-LCRE " [digit]);
+        if (dot)
+            putchar ('.');
+    }
+    printf ("' (%x %x) %08x\n", calc.ik1302.R[39], calc.ik1302.R[36],
+        calc.ik1302.command);
 }
 
 //
-// Poll the keypad.
+// Print the display, when changed.
 //
-int calc_keypad()
+static void print_display (void)
 {
-    return keycode;
+    int i;
+
+    if (! display_changed)
+        return;
+    printf ("'");
+    for (i=0; i<12; i++) {
+        putchar ("0123456789-LCRE " [display[11-i]]);
+        if (show_dot[11-i])
+            putchar ('.');
+    }
+    printf ("'\n");
+    display_changed = 0;
 }
 
 //
-// Poll optional peripherals.
+// Run the test with calc_press_key(): every key is released
+// as soon as it is taken.  Step numbers and running state
+// are not printed.
 //
-void calc_poll()
+static void run_keys (void)
 {
-    // Empty.
+    int next = 0, key;
+    unsigned long n, nwords = 0;
+
+    calc_step (&calc);
+    for (;;) {
+        print_display ();
+
+        if (test [next] == 0xff)
+            break;
+
+        // Switch radians/grads/degrees mode.
+        if (test [next] > 0 && test [next] < 16)
+            rad_grad_deg = test [next++];
+        calc_set_input (&calc, 0, rad_grad_deg);
+
+        // Releases are done by calc_press_key().
+        key = test [next++];
+        if (key == 0)
+            continue;
+        n = calc_press_key (&calc, key, 1000000);
+        if (n == 0) {
+            printf ("Key %02x not taken.\n", key);
+            break;
+        }
+        nwords += n;
+
+        // Refresh the display, with keys released.
+        calc_step (&calc);
+    }
+    printf ("Keys took %lu words.\n", nwords);
 }
 
-int main()
+int main (int argc, char **argv)
 {
     int running, next = 0;
 
@@ -220,11 +284,26 @@ int main()
 #else
     printf ("Started MK-61.\n");
 #endif
-    calc_init();
+    calc_init (&calc, &callbacks, 0);
+
+    // Option -r: use per-cycle reference simulation.
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] == 'r')
+        calc_set_reference (&calc, 1);
+
+    // Option -t: trace the display in run mode.
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] == 't')
+        calc_set_trace (&calc, calc_trace);
+
+    // Option -k: press keys with minimal delay.
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] == 'k') {
+        run_keys ();
+        printf ("Finished.\n");
+        return 0;
+    }
 
     for (;;) {
-        // Simulate one cycle of the calculator.
-        running = calc_step();
+        // Simulate one step of the calculator.
+        running = calc_step (&calc);
         step_num++;
 
         if (running) {
@@ -234,16 +313,8 @@ int main()
         }
 
         if (display_changed) {
-            int i;
-
-            printf ("%3u -- '", step_num);
-            for (i=0; i<12; i++) {
-                putchar ("0123456789-LCRE " [display[11-i]]);
-                if (show_dot[11-i])
-                    putchar ('.');
-            }
-            printf ("'\n");
-            display_changed = 0;
+            printf ("%3u -- ", step_num);
+            print_display ();
         }
 
         if (test [next] == 0xff)
@@ -254,6 +325,7 @@ int main()
             rad_grad_deg = test [next++];
 
         keycode = test [next++];
+        calc_set_input (&calc, keycode, rad_grad_deg);
     }
     printf ("Finished.\n");
     return 0;
@@ -0,0 +1,352 @@
+/*
+ * Compare the word-level simulation with the per-cycle reference.
+ *
+ * Copyright (C) 2013 Serge Vakulenko, <serge.vakulenko@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "calc.h"
+
+//
+// Two calculators get the same random keystrokes: one runs
+// the word-level kernels, the other is simulated cycle by cycle.
+// After every word, the state of all chips and memory
+// must be identical.
+// Keys are held and released for a few steps, as by a human,
+// so the calculator enters and runs programs as well.
+// From time to time, the reference calculator is restarted
+// from a snapshot of the other one.
+// A third calculator runs calc_step(), or calc_fast_forward()
+// when keys are released, which skip the idle loop.  It must be
+// identical to the others after every step.
+// Values read through a view must be the same as extracted
+// by calc_get_stack(), calc_get_regs() and calc_get_code(),
+// and the view must tell exactly what has changed.
+//
+static const unsigned char keys[] = {
+    KEY_0, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9,
+    KEY_ADD, KEY_SUB, KEY_MUL, KEY_DIV, KEY_XY, KEY_DOT, KEY_NEG,
+    KEY_EXP, KEY_CLEAR, KEY_ENTER, KEY_STOPGO, KEY_GOTO, KEY_RET,
+    KEY_CALL, KEY_STORE, KEY_NEXT, KEY_LOAD, KEY_PREV, KEY_K, KEY_F,
+};
+
+calc_t word, cycle, warm, skip;
+calc_view_t view;
+unsigned key_pressed, switch_rgd = MODE_DEGREES;
+unsigned long long nskipped;
+unsigned nchanges;
+
+int verbose;
+unsigned long long seed = 1;
+
+static int calc_rgd (void *arg)
+{
+    return MODE_DEGREES;
+}
+
+static int calc_keypad (void *arg)
+{
+    return 0;
+}
+
+static void calc_display (void *arg, int i, int digit, int dot)
+{
+}
+
+static const calc_callbacks_t callbacks = {
+    calc_display, calc_rgd, calc_keypad, 0,
+};
+
+static int skip_rgd (void *arg)
+{
+    return switch_rgd;
+}
+
+static int skip_keypad (void *arg)
+{
+    return key_pressed;
+}
+
+static const calc_callbacks_t skip_callbacks = {
+    calc_display, skip_rgd, skip_keypad, 0,
+};
+
+//
+// Pseudo-random numbers: xorshift64.
+//
+static unsigned rnd (unsigned n)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (seed >> 11) % n;
+}
+
+//
+// Compare the state of two PLM chips.
+//
+static int same_plm (const plm_t *a, const plm_t *b)
+{
+    return memcmp (a->R, b->R, sizeof (a->R)) == 0 &&
+           memcmp (a->ST, b->ST, sizeof (a->ST)) == 0 &&
+           memcmp (a->show_dot, b->show_dot, sizeof (a->show_dot)) == 0 &&
+           a->S == b->S && a->Q == b->Q && a->carry == b->carry &&
+           a->keypad_event == b->keypad_event && a->dot == b->dot &&
+           a->command == b->command &&
+           a->enable_display == b->enable_display;
+}
+
+//
+// Return the name of the first part with a different state, or 0.
+//
+static const char *compare (const calc_t *a, const calc_t *b)
+{
+    if (! same_plm (&a->ik1302, &b->ik1302))
+        return "ИК1302";
+    if (! same_plm (&a->ik1303, &b->ik1303))
+        return "ИК1303";
+#ifndef MK_54
+    if (! same_plm (&a->ik1306, &b->ik1306))
+        return "ИК1306";
+#endif
+    if (memcmp (a->ring, b->ring, sizeof (a->ring)) != 0 ||
+        a->head != b->head || a->word != b->word)
+        return "memory";
+    return 0;
+}
+
+//
+// Simulate one step of both calculators word by word,
+// with the keypad and switch set as by calc_step().
+// Count words in run mode.
+// Return 0 on success, or -1 on mismatch.
+//
+static int step (unsigned keycode, unsigned rgd,
+    unsigned long long *nwords, unsigned long long *nrun)
+{
+    calc_t *c[2] = { &word, &cycle };
+    const char *chip;
+    int k, i;
+
+    for (k=0; k<STEP_NWORDS; k++) {
+        for (i=0; i<2; i++) {
+            c[i]->ik1302.keyb_x = keycode >> 4;
+            c[i]->ik1302.keyb_y = keycode & 0xf;
+            c[i]->ik1303.keyb_x = rgd;
+            c[i]->ik1303.keyb_y = 1;
+            calc_step_word (c[i]);
+        }
+        ++*nwords;
+        if (word.ik1302.dot == 11)
+            ++*nrun;
+        chip = compare (&word, &cycle);
+        if (chip) {
+            printf ("Mismatch in %s at word %llu, key %02x\n",
+                chip, *nwords, keycode);
+            return -1;
+        }
+    }
+
+    // The same step with skipping of the idle loop.
+    key_pressed = keycode;
+    switch_rgd = rgd;
+    if (keycode == 0 && (*nwords / STEP_NWORDS) % 2) {
+        skip.ik1302.keyb_x = 0;
+        skip.ik1302.keyb_y = 0;
+        skip.ik1303.keyb_x = rgd;
+        skip.ik1303.keyb_y = 1;
+        nskipped += STEP_NWORDS - calc_fast_forward (&skip, STEP_NWORDS);
+    } else
+        calc_step (&skip);
+
+    // Display of calc_step() clears enable_display, which
+    // the microcode never reads.
+    word.ik1302.enable_display = skip.ik1302.enable_display;
+    cycle.ik1302.enable_display = skip.ik1302.enable_display;
+    chip = compare (&skip, &word);
+    if (chip) {
+        printf ("Mismatch in %s with idle skip at word %llu, key %02x\n",
+            chip, *nwords, keycode);
+        return -1;
+    }
+    return 0;
+}
+
+//
+// Compare the view with the extracted values.
+// Return -1 on mismatch.
+//
+static int check_view (unsigned step)
+{
+    static unsigned char stack [5][6], regs [DATA_NREGS][6];
+    static unsigned char code [CODE_NBYTES];
+    static int valid;
+    unsigned char s [5][6], r [DATA_NREGS][6], p [CODE_NBYTES], value [6];
+    unsigned mask = 0, changed;
+    int i;
+
+    calc_get_stack (&word, s);
+    calc_get_regs (&word, r);
+    calc_get_code (&word, p);
+    for (i=0; i<5; i++) {
+        calc_view_stack (&view, i, value);
+        if (memcmp (value, s[i], 6) != 0) {
+            printf ("Mismatch in view of stack %d at step %u\n", i, step);
+            return -1;
+        }
+    }
+    for (i=0; i<DATA_NREGS; i++) {
+        calc_view_reg (&view, i, value);
+        if (memcmp (value, r[i], 6) != 0) {
+            printf ("Mismatch in view of register %d at step %u\n", i, step);
+            return -1;
+        }
+    }
+    for (i=0; i<CODE_NBYTES; i++) {
+        if (calc_view_code (&view, i) != p[i]) {
+            printf ("Mismatch in view of code %d at step %u\n", i, step);
+            return -1;
+        }
+    }
+
+    if (! valid || memcmp (s, stack, sizeof (s)) != 0)
+        mask |= CALC_VIEW_STACK;
+    if (! valid || memcmp (r, regs, sizeof (r)) != 0)
+        mask |= CALC_VIEW_REGS;
+    if (! valid || memcmp (p, code, sizeof (p)) != 0)
+        mask |= CALC_VIEW_CODE;
+    changed = calc_view_changed (&view);
+    if (changed != mask) {
+        printf ("View tells changes %x instead of %x at step %u\n",
+            changed, mask, step);
+        return -1;
+    }
+    if (mask)
+        nchanges++;
+    memcpy (stack, s, sizeof (s));
+    memcpy (regs, r, sizeof (r));
+    memcpy (code, p, sizeof (p));
+    valid = 1;
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    unsigned nsteps = 2000, keycode = 0, rgd = MODE_DEGREES, hold = 0, i;
+    unsigned long long nwords = 0, nrun = 0;
+    unsigned nsnapshots = 0;
+    static calc_state_t state, bad;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "n:s:v")) != -1) {
+        switch (opt) {
+        case 'n':   // Number of steps.
+            nsteps = strtoul (optarg, 0, 0);
+            break;
+        case 's':   // Random seed.
+            seed = strtoull (optarg, 0, 0);
+            break;
+        case 'v':   // Verbose.
+            verbose++;
+            break;
+        default:
+            fprintf (stderr, "Usage:\n");
+            fprintf (stderr, "    wordtest [-v] [-n count] [-s seed]\n");
+            return 1;
+        }
+    }
+
+    calc_init (&word, &callbacks, 0);
+    calc_init (&cycle, &callbacks, 0);
+    calc_set_reference (&cycle, 1);
+    calc_init (&skip, &skip_callbacks, 0);
+    calc_view_init (&view, &word);
+
+    // First step after power on must give the warm start image,
+    // with any position of the switch.
+    rgd = MODE_RADIANS + rnd (3);
+    if (step (0, rgd, &nwords, &nrun) < 0)
+        return 1;
+    calc_init (&warm, &callbacks, 0);
+    calc_warm_start (&warm, rgd);
+    if (compare (&warm, &word)) {
+        printf ("Mismatch in %s after warm start\n", compare (&warm, &word));
+        return 1;
+    }
+    if (warm.rgd != rgd) {
+        printf ("Switch position lost by warm start\n");
+        return 1;
+    }
+
+    for (i=0; i<nsteps; i++) {
+        if (hold == 0) {
+            // Press a key, or release it.
+            if (keycode == 0) {
+                keycode = keys [rnd (sizeof (keys))];
+                if (rnd (16) == 0)
+                    rgd = MODE_RADIANS + rnd (3);
+            } else
+                keycode = 0;
+            hold = 2 + rnd (4);
+            if (verbose && keycode)
+                printf ("step %u: key %02x\n", i, keycode);
+        }
+        hold--;
+        if (i % 64 == 63) {
+            // Restart the reference from a snapshot.
+            calc_save_state (&word, &state);
+            calc_init (&cycle, &callbacks, 0);
+            calc_set_reference (&cycle, 1);
+
+            // Corrupted snapshots must be rejected.
+            bad = state;
+            bad.ring [rnd (sizeof (bad.ring))] = 16;
+            if (calc_load_state (&cycle, &bad)) {
+                printf ("Corrupted ring loaded at step %u\n", i);
+                return 1;
+            }
+            bad = state;
+            bad.ik1302.R [rnd (REG_NWORDS)] = 0xff;
+            if (calc_load_state (&cycle, &bad)) {
+                printf ("Corrupted register loaded at step %u\n", i);
+                return 1;
+            }
+            if (! calc_load_state (&cycle, &state)) {
+                printf ("Cannot load snapshot at step %u\n", i);
+                return 1;
+            }
+            nsnapshots++;
+        }
+        if (step (keycode, rgd, &nwords, &nrun) < 0)
+            return 1;
+        if (check_view (i) < 0)
+            return 1;
+    }
+    printf ("%u steps, %llu words compared, %llu in run mode, %u snapshots.\n",
+        nsteps, nwords, nrun, nsnapshots);
+    printf ("%llu words skipped by fast forward.\n", nskipped);
+    printf ("%u steps with changes told by the view.\n", nchanges);
+    printf ("Word test PASSED.\n");
+    return 0;
+}